@@ -0,0 +1,29 @@
+#!/bin/bash
+# Times the bank on generated workloads of several sizes.
+# Usage: bench/run.sh BANK WORKLOAD [extra bank options]
+# BANK is the bank binary and WORKLOAD the generator built from bench/workload.cpp.
+# Each timing line of the report is one phase of one run: how many items it handled, how long it took and the throughput.
+# Each latency line is one command or query type: how many ran and their p50 and p99 latency from the --stats histograms,
+# whose buckets are powers of two, so each percentile is the upper bound of the bucket it falls in.
+
+BANK=$1
+WORKLOAD=$2
+shift 2
+DATA=${BENCH_DIR:-${TMPDIR:-/tmp}/bank-bench}
+mkdir -p "$DATA"
+
+# users operations queries
+SIZES=${BENCH_SIZES:-"1000:100000:10000 10000:1000000:50000 100000:4000000:100000"}
+
+for size in $SIZES; do
+    IFS=: read -r users operations queries <<< "$size"
+    reg="$DATA/reg-$users-$operations.txt"
+    commands="$DATA/commands-$users-$operations-$queries.txt"
+    if [ ! -f "$commands" ]; then
+        "$WORKLOAD" --reg "$reg" --commands "$commands" --users "$users" --operations "$operations" --queries "$queries" || exit 1
+    fi
+    stats="$DATA/stats-$users-$operations-$queries.json"
+    echo "== $users users, $operations operations, $queries queries"
+    "$BANK" --timings --stats "$stats" "$@" -f "$reg" < "$commands" 2>&1 > /dev/null | grep '^timing' || exit 1
+    sed -nE 's/^ *"([a-z]+)": \{"count": ([0-9]+),.*"p50_ns": ([0-9]+), "p99_ns": ([0-9]+).*/latency \1: \2 with p50 \3 ns, p99 \4 ns/p' "$stats"
+done
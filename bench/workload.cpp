@@ -0,0 +1,264 @@
+// Identifier: 292F24D17A4455C1B5133EDD8C7CEAA0C9570A98
+
+// These are the libraries that are used by the code.
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ Generates a registration file and a command file for the bank, for benchmarking it at sizes far beyond the shipped tests.
+ The same options and seed always produce the same files.
+ */
+struct WorkloadOptions
+{
+    string reg_file;
+    string command_file;
+    uint64_t seed = 281;
+    size_t users = 1000;
+    size_t operations = 10000;
+    size_t queries = 1000;
+    // The share of operations that are place commands; the rest are logins, logouts and balance checks.
+    double place_rate = 0.7;
+    // The share of places that execute some time after they are placed rather than straight away.
+    double future_share = 0.5;
+    // The chance that a login comes from a new IP address instead of one the user has used before.
+    double ip_churn = 0.1;
+    // The share of places for more money than the sender could possibly have.
+    double overdraft_rate = 0.05;
+    // Relative weights of list, revenue, history and summary queries.
+    double query_mix[4] = {1, 1, 1, 1};
+};
+
+// Timestamps are yymmddhhmmss numbers, written as colon separated pairs of digits.
+string format_time(uint64_t time){
+    string digits = to_string(time);
+    digits.insert(0, 12 - min<size_t>(12, digits.size()), '0');
+    string text;
+    for (size_t i = 0; i < 12; i += 2) {
+        if (i > 0) {
+            text += ':';
+        }
+        text += digits.substr(i, 2);
+    }
+    return text;
+}
+
+// Reads the four comma separated query weights; missing ones are left as they were.
+void parse_query_mix(const char* text, double mix[4]){
+    for (size_t i = 0; i < 4 && *text; ++i) {
+        char* end;
+        mix[i] = strtod(text, &end);
+        text = (*end == ',') ? end + 1 : end;
+    }
+}
+
+void get_options(int argc, char * argv[], WorkloadOptions &options) {
+  opterr = false;
+  int choice;
+  int dummy = 0;
+  option long_options[] = {
+    { "help",        no_argument,       nullptr, 'h'  },
+    { "reg",         required_argument, nullptr, 'r'  },
+    { "commands",    required_argument, nullptr, 'c'  },
+    { "seed",        required_argument, nullptr, 's'  },
+    { "users",       required_argument, nullptr, 'u'  },
+    { "operations",  required_argument, nullptr, 'o'  },
+    { "queries",     required_argument, nullptr, 'q'  },
+    { "place-rate",  required_argument, nullptr, 'p'  },
+    { "future",      required_argument, nullptr, 'f'  },
+    { "ip-churn",    required_argument, nullptr, 'i'  },
+    { "overdraft",   required_argument, nullptr, 'd'  },
+    { "query-mix",   required_argument, nullptr, 'm'  },
+    { nullptr,       0,                 nullptr, '\0' }
+  };
+  while ((choice = getopt_long(argc, argv, "hr:c:s:u:o:q:p:f:i:d:m:", long_options, &dummy)) != -1) {
+    switch (choice) {
+      case 'h':
+        cout << "Generates a bank workload: workload --reg FILE --commands FILE [options]\n";
+        cout << "  --seed N        random seed (281)\n";
+        cout << "  --users N       registered users (1000)\n";
+        cout << "  --operations N  commands before $$$ (10000)\n";
+        cout << "  --queries N     queries after $$$ (1000)\n";
+        cout << "  --place-rate F  share of operations that are places (0.7)\n";
+        cout << "  --future F      share of places that execute later (0.5)\n";
+        cout << "  --ip-churn F    chance a login uses a new IP (0.1)\n";
+        cout << "  --overdraft F   share of places the sender cannot afford (0.05)\n";
+        cout << "  --query-mix L,R,H,S  weights of the query types (1,1,1,1)\n";
+        exit(0);
+      case 'r':
+        options.reg_file = optarg;
+        break;
+      case 'c':
+        options.command_file = optarg;
+        break;
+      case 's':
+        options.seed = strtoull(optarg, NULL, 10);
+        break;
+      case 'u':
+        options.users = max<size_t>(2, strtoull(optarg, NULL, 10));
+        break;
+      case 'o':
+        options.operations = strtoull(optarg, NULL, 10);
+        break;
+      case 'q':
+        options.queries = strtoull(optarg, NULL, 10);
+        break;
+      case 'p':
+        options.place_rate = strtod(optarg, NULL);
+        break;
+      case 'f':
+        options.future_share = strtod(optarg, NULL);
+        break;
+      case 'i':
+        options.ip_churn = strtod(optarg, NULL);
+        break;
+      case 'd':
+        options.overdraft_rate = strtod(optarg, NULL);
+        break;
+      case 'm':
+        parse_query_mix(optarg, options.query_mix);
+        break;
+      default:
+        cerr << "Error: invalid option" << endl;
+        exit(1);
+    }
+  }
+  if (options.reg_file.empty() || options.command_file.empty()) {
+    cerr << "Both --reg and --commands must be given" << endl;
+    exit(1);
+  }
+}
+
+struct Account
+{
+    string user_ID;
+    string pin;
+    // The IP addresses the user has logged in from and not logged out of.
+    vector<string> IPs;
+    uint32_t next_IP = 0;
+    // Whether the user is in the list of logged in users, and where.
+    bool listed = false;
+    size_t slot = 0;
+};
+
+int main(int argc, char* argv[]) {
+    ios_base::sync_with_stdio(false);
+    WorkloadOptions options;
+    get_options(argc, argv, options);
+    mt19937_64 random(options.seed);
+    uniform_real_distribution<double> chance(0, 1);
+    auto pick = [&random](size_t count) {
+        return static_cast<size_t>(random() % count);
+    };
+
+    // Everyone registers during the first day; the operations start on the second.
+    const uint64_t first_day = 80101000000;
+    uint64_t now = first_day + 1000000;
+    vector<Account> accounts(options.users);
+    ofstream reg(options.reg_file);
+    for (size_t i = 0; i < accounts.size(); ++i) {
+        Account &account = accounts[i];
+        account.user_ID = "user" + to_string(i);
+        account.pin = to_string(100000 + pick(900000));
+        uint64_t balance = 1000 + pick(1000000);
+        reg << format_time(first_day + pick(240000)) << '|' << account.user_ID << '|' << account.pin << '|' << balance << '\n';
+    }
+
+    ofstream commands(options.command_file);
+    commands << "# Generated workload, seed " << options.seed << "\n";
+    // Users with an open session, so that most places come from someone who is logged in.
+    vector<size_t> logged_in;
+    auto new_IP = [](size_t user, uint32_t count) {
+        return "10." + to_string(count % 256) + '.' + to_string(user / 256 % 256) + '.' + to_string(user % 256);
+    };
+    auto log_in = [&](size_t user) {
+        Account &account = accounts[user];
+        if (account.IPs.empty() || chance(random) < options.ip_churn) {
+            account.IPs.push_back(new_IP(user, account.next_IP++));
+        }
+        commands << "login " << account.user_ID << ' ' << account.pin << ' ' << account.IPs.back() << '\n';
+        if (!account.listed) {
+            account.listed = true;
+            account.slot = logged_in.size();
+            logged_in.push_back(user);
+        }
+    };
+    for (size_t k = 0; k < options.operations; ++k) {
+        double kind = chance(random);
+        if (kind < options.place_rate && !logged_in.empty()) {
+            size_t sender = logged_in[pick(logged_in.size())];
+            size_t recipient = pick(accounts.size() - 1);
+            if (recipient >= sender) {
+                recipient++;
+            }
+            // Time moves forward by up to ten minutes between places, which spreads a large run over many days.
+            now += pick(1000);
+            uint64_t exec = now;
+            if (chance(random) < options.future_share) {
+                exec += 1 + pick(2999999);
+            }
+            uint64_t amount = (chance(random) < options.overdraft_rate) ? 100000000 + pick(100000000) : 1 + pick(5000);
+            const Account &from = accounts[sender];
+            commands << "place " << format_time(now) << ' ' << from.IPs.back() << ' ' << from.user_ID << ' ' << accounts[recipient].user_ID << ' '
+                     << amount << ' ' << format_time(exec) << ' ' << (chance(random) < 0.5 ? 's' : 'o') << '\n';
+        }
+        else {
+            // The other operations are split evenly between logins, logouts and balance checks.
+            double other = chance(random);
+            size_t user = pick(accounts.size());
+            Account &account = accounts[user];
+            if (other < 1.0 / 3 || account.IPs.empty()) {
+                log_in(user);
+            }
+            else if (other < 2.0 / 3) {
+                commands << "out " << account.user_ID << ' ' << account.IPs.back() << '\n';
+                account.IPs.pop_back();
+                if (account.IPs.empty()) {
+                    account.listed = false;
+                    // The last user in the list takes this user's place.
+                    accounts[logged_in.back()].slot = account.slot;
+                    logged_in[account.slot] = logged_in.back();
+                    logged_in.pop_back();
+                }
+            }
+            else {
+                commands << "balance " << account.user_ID << ' ' << account.IPs.back() << '\n';
+            }
+        }
+    }
+    commands << "$$$\n";
+
+    double total_weight = options.query_mix[0] + options.query_mix[1] + options.query_mix[2] + options.query_mix[3];
+    uint64_t span = now + 3000000 - first_day;
+    for (size_t k = 0; k < options.queries; ++k) {
+        double kind = chance(random) * total_weight;
+        uint64_t start = first_day + pick(span);
+        // Intervals are kept to about a thousandth of the whole run so that list queries stay readable.
+        uint64_t end = start + 1 + pick(span / 1000 + 1);
+        if (kind < options.query_mix[0]) {
+            commands << "l " << format_time(start) << ' ' << format_time(end) << '\n';
+        }
+        else if (kind < options.query_mix[0] + options.query_mix[1]) {
+            commands << "r " << format_time(start) << ' ' << format_time(end) << '\n';
+        }
+        else if (kind < total_weight - options.query_mix[3]) {
+            commands << "h " << accounts[pick(accounts.size())].user_ID << '\n';
+        }
+        else {
+            commands << "s " << format_time(start) << '\n';
+        }
+    }
+    if (!reg || !commands) {
+        cerr << "The workload files could not be written" << endl;
+        exit(1);
+    }
+    return 0;
+}
@@ -2,33 +2,337 @@
 
 // These are the libraries that are used by the code.
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <deque>
+#include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <getopt.h>
 #include <iostream>
-#include <queue>
+#include <numeric>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 using namespace std;
 
-// This class encapsulates each transactions' data and provides methods to access and modify transaction details.
-class Transaction
+// This enum records who pays the fee of a transaction; 'o' means the sender pays and 's' means the fee is shared equally.
+enum class FeePayer : uint8_t
+{
+    Neither,
+    Sender,
+    Shared
+};
+
+/*
+ Converts the fixed-width "ab:cd:ef" group starting at p into the number abcdef.
+ The eight bytes are handled as one 64-bit word (SWAR): subtracting '0' from every byte turns digits into their values, the two colons are masked off,
+ and a single multiply-add puts 10 * d[i] + d[i + 1] in byte i, so the three two-digit fields can be read straight out of bytes 0, 3 and 6.
+*/
+inline uint64_t parse_time_group(const char* p){
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t chunk;
+    memcpy(&chunk, p, sizeof(chunk));
+    chunk = (chunk - 0x3030303030303030ULL) & 0x0F0F000F0F000F0FULL;
+    uint64_t pairs = chunk * 10 + (chunk >> 8);
+    return (pairs & 0xFF) * 10000 + ((pairs >> 24) & 0xFF) * 100 + ((pairs >> 48) & 0xFF);
+#else
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; i += 3) {
+        value = value * 100 + static_cast<uint64_t>(p[i] - '0') * 10 + static_cast<uint64_t>(p[i + 1] - '0');
+    }
+    return value;
+#endif
+}
+
+/*
+ Every timestamp in the input is in the format yy:mm:dd:hh:mm:ss, and the bank works with the twelve digits as one number yymmddhhmmss.
+ This function does that conversion without building any temporary strings. Anything that is not a full 17-character timestamp
+ takes the slow path, which reads the digits up to the first character that is neither a digit nor a colon.
+*/
+inline uint64_t parse_timestamp(string_view ts){
+    if (ts.size() >= 17) {
+        return parse_time_group(ts.data()) * 1000000 + parse_time_group(ts.data() + 9);
+    }
+    uint64_t value = 0;
+    for (char c : ts) {
+        if (c == ':') {
+            continue;
+        }
+        if (c < '0' || c > '9') {
+            break;
+        }
+        value = value * 10 + static_cast<uint64_t>(c - '0');
+    }
+    return value;
+}
+
+// Reads the leading decimal digits of a field, the way strtoull does for the numbers in the input files.
+inline uint64_t parse_number(string_view field){
+    uint64_t value = 0;
+    for (char c : field) {
+        if (c < '0' || c > '9') {
+            break;
+        }
+        value = value * 10 + static_cast<uint64_t>(c - '0');
+    }
+    return value;
+}
+
+/*
+ Parses a dotted-quad IPv4 address into its 32-bit value. Only the canonical spelling is accepted (four parts of 0 to 255 with no
+ leading zeros), because two spellings of one address are different IPs to the bank; anything else returns false.
+ */
+inline bool parse_ipv4(string_view field, uint32_t &address){
+    uint32_t value = 0;
+    size_t parts = 0;
+    size_t i = 0;
+    while (parts < 4) {
+        size_t start = i;
+        uint32_t part = 0;
+        while (i < field.size() && field[i] >= '0' && field[i] <= '9' && i - start < 3) {
+            part = part * 10 + static_cast<uint32_t>(field[i] - '0');
+            i++;
+        }
+        if (i == start || part > 255 || (field[start] == '0' && i - start > 1)) {
+            return false;
+        }
+        value = (value << 8) | part;
+        parts++;
+        if (parts < 4) {
+            if (i == field.size() || field[i] != '.') {
+                return false;
+            }
+            i++;
+        }
+    }
+    if (i != field.size()) {
+        return false;
+    }
+    address = value;
+    return true;
+}
+
+/*
+ This class gives read-only access to the whole contents of a file descriptor.
+ Regular files are memory mapped so nothing is copied; anything else (such as a pipe) is read into a buffer once.
+*/
+class MappedFile
+{
+  public:
+    explicit MappedFile(int fd){
+      struct stat info;
+      if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+        size = static_cast<size_t>(info.st_size);
+        if (size == 0) {
+          return;
+        }
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+          // The file is read front to back, so the kernel can read ahead aggressively.
+          madvise(addr, size, MADV_SEQUENTIAL);
+          mapped = static_cast<const char*>(addr);
+          return;
+        }
+      }
+      // Not a regular file or mmap failed, so fall back to reading it in large blocks.
+      size = 0;
+      char block[1 << 16];
+      ssize_t got;
+      while ((got = read(fd, block, sizeof(block))) > 0) {
+        Buffer.insert(Buffer.end(), block, block + got);
+      }
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile(){
+      if (mapped) {
+        munmap(const_cast<char*>(mapped), size);
+      }
+    }
+    string_view contents() const{
+      if (mapped) {
+        return string_view(mapped, size);
+      }
+      return string_view(Buffer.data(), Buffer.size());
+    }
+  private:
+    const char* mapped = nullptr;
+    size_t size = 0;
+    vector<char> Buffer;
+};
+
+/*
+ This class collects everything the program prints in one large buffer and writes it out in big blocks.
+ Integers are formatted straight into the buffer with to_chars, and nothing is written until the buffer fills up or the program ends,
+ so no output line costs a flush or a temporary string.
+*/
+class OutputBuffer
 {
   public:
-    Transaction(uint64_t placement_time, const string &sender, const string &recepient, uint64_t amount, uint64_t exec_time, const string &exec_date, const string &fee_payer, size_t trans_ID)
-    :placement_time(placement_time), sender(sender), recepient(recepient), amount(amount), exec_time(exec_time),  exec_date(exec_date), fee_payer(fee_payer), trans_ID(trans_ID) {
-      fee = 0;
+    explicit OutputBuffer(int fd)
+    :fd(fd), capacity(1 << 20), Buffer(new char[capacity]) {}
+    // A buffer with no file behind it keeps everything written to it in memory, growing as needed; see text.
+    OutputBuffer()
+    :fd(-1), capacity(1 << 10), Buffer(new char[capacity]) {}
+    OutputBuffer(const OutputBuffer &) = delete;
+    OutputBuffer &operator=(const OutputBuffer &) = delete;
+    ~OutputBuffer(){
+      flush();
+    }
+    OutputBuffer &operator<<(string_view text){
+      // An empty view may have no data pointer at all, so it must not reach memcpy.
+      if (text.empty()) {
+        return *this;
+      }
+      if (text.size() > capacity - used) {
+        if (fd < 0) {
+          grow(used + text.size());
+        }
+        else {
+          flush();
+          // Anything bigger than the whole buffer is written straight through.
+          if (text.size() > capacity) {
+            write_all(text.data(), text.size());
+            return *this;
+          }
+        }
+      }
+      memcpy(Buffer.get() + used, text.data(), text.size());
+      used += text.size();
+      return *this;
+    }
+    OutputBuffer &operator<<(char c){
+      if (used == capacity) {
+        make_room(1);
+      }
+      Buffer[used++] = c;
+      return *this;
+    }
+    template <typename Integer, typename = enable_if_t<is_integral<Integer>::value>>
+    OutputBuffer &operator<<(Integer value){
+      // 20 characters is enough for any 64-bit integer.
+      if (capacity - used < 20) {
+        make_room(20);
+      }
+      used = static_cast<size_t>(to_chars(Buffer.get() + used, Buffer.get() + capacity, value).ptr - Buffer.get());
+      return *this;
+    }
+    /*
+     Writes out everything buffered so far. An in-memory buffer has nowhere to write it and keeps it.
+     Returns false if this or any earlier write to the file failed, so whoever needs the bytes on disk can check once at the end.
+    */
+    bool flush(){
+      if (fd < 0) {
+        return true;
+      }
+      write_all(Buffer.get(), used);
+      used = 0;
+      return !write_failed;
+    }
+    // Everything written to an in-memory buffer.
+    string_view text() const{
+      return string_view(Buffer.get(), used);
+    }
+    // Forgets everything written to an in-memory buffer, keeping its memory for what comes next.
+    void clear(){
+      used = 0;
+    }
+  private:
+    int fd;
+    size_t capacity;
+    unique_ptr<char[]> Buffer;
+    size_t used = 0;
+    // Set once a write has failed; later output is dropped rather than written after a gap.
+    bool write_failed = false;
+    // Makes room for size more bytes: a file-backed buffer writes out what it holds and an in-memory one grows.
+    void make_room(size_t size){
+      if (fd < 0) {
+        grow(used + size);
+      }
+      else {
+        flush();
+      }
     }
+    void grow(size_t needed){
+      size_t new_capacity = max(capacity * 2, needed);
+      unique_ptr<char[]> bigger(new char[new_capacity]);
+      memcpy(bigger.get(), Buffer.get(), used);
+      Buffer = move(bigger);
+      capacity = new_capacity;
+    }
+    // Writes all of text, retrying short and interrupted writes. Returns false if the file refuses it.
+    bool write_all(const char* text, size_t size){
+      if (write_failed) {
+        return false;
+      }
+      while (size > 0) {
+        ssize_t wrote = write(fd, text, size);
+        if (wrote < 0 && errno == EINTR) {
+          continue;
+        }
+        if (wrote <= 0) {
+          write_failed = true;
+          return false;
+        }
+        text += wrote;
+        size -= static_cast<size_t>(wrote);
+      }
+      return true;
+    }
+};
+
+// Converts a fee payer token from a place command; "o" means the sender pays and "s" means the fee is shared.
+inline FeePayer parse_fee_payer(string_view token){
+    if (token == "o") {
+        return FeePayer::Sender;
+    }
+    if (token == "s") {
+        return FeePayer::Shared;
+    }
+    return FeePayer::Neither;
+}
+
+/*
+ This class encapsulates each transactions' data and provides methods to access and modify transaction details.
+ Users are referred to by their interned index in the bank's user table rather than by name, which keeps the record trivially copyable and 48 bytes wide.
+*/
+class Transaction
+{
+  public:
+    Transaction(uint64_t placement_time, uint32_t sender, uint32_t recepient, uint64_t amount, uint64_t exec_time, FeePayer fee_payer, uint32_t trans_ID)
+    :placement_time(placement_time), amount(amount), exec_time(exec_time), fee(0), sender(sender), recepient(recepient), trans_ID(trans_ID), fee_payer(fee_payer) {}
+    // An empty record, only used as storage that a snapshot is read into.
+    Transaction() = default;
     uint64_t get_placement_time() const{
       return placement_time;
     }
-    string get_sender() {
+    uint32_t get_sender() const{
       return sender;
     }
-    string get_recepient() {
+    uint32_t get_recepient() const{
       return recepient;
     }
     uint64_t get_amount() const{
@@ -37,13 +341,10 @@ class Transaction
     uint64_t get_exec_time() const{
       return exec_time;
     }
-    string get_exec_date() const{
-      return exec_date;
-    }
-    string get_fee_payer() const{
+    FeePayer get_fee_payer() const{
       return fee_payer;
     }
-    size_t get_trans_ID() const{
+    uint32_t get_trans_ID() const{
       return trans_ID;
     }
     uint64_t get_fee() const{
@@ -53,41 +354,246 @@ class Transaction
       fee = bankFee;
     }
   private:
+    // The 64-bit fields come first so the record packs without padding between members.
     uint64_t placement_time;
-    string sender;
-    string recepient;
     uint64_t amount;
     uint64_t exec_time;
-    string exec_date;
-    string fee_payer;
-    size_t trans_ID;
     uint64_t fee;
+    uint32_t sender;
+    uint32_t recepient;
+    uint32_t trans_ID;
+    FeePayer fee_payer;
+    // The bytes after fee_payer would be padding; they are spelled out and zeroed so a record saved raw never carries stray bytes.
+    uint8_t reserved[3] = {};
 };
+static_assert(is_trivially_copyable<Transaction>::value, "Transaction must stay a plain record");
+static_assert(sizeof(Transaction) == 48, "Transaction should pack into 48 bytes");
 
-// This class defines the criteria for ordering transactions in the PQ. This is the comparator the PQ using. This is a functor.
-class TransactionCompare
+/*
+ This class holds the pending transactions and hands them back in (exec_time, trans_ID) order, earliest first.
+ It is a calendar queue: a ring of buckets that each cover bucket_width consecutive exec times. place_transaction never accepts an exec_time more than
+ three days (3000000) past the place time, and place times never decrease, so every pending transaction lies inside a window that the ring covers.
+ Pushing appends a 16-byte entry to its bucket; the bucket is sorted once when the queue reaches it, and due entries are removed from its back.
+ The transactions themselves sit in a slab of reusable slots, so only the small entries are ever moved around.
+*/
+class PendingQueue
 {
   public:
-  bool operator() (Transaction const &trans_L, Transaction const &trans_R) {
-    // The statement "If L < R then return false" implies that this is a min heap.
-    if (trans_L.get_exec_time() < trans_R.get_exec_time()) {
-        return false;
+    PendingQueue()
+    :Buckets(initial_buckets), Sorted(initial_buckets, 0) {}
+    bool empty() const{
+      return count == 0;
     }
-    // Second condition to break ties.
-    else if (trans_L.get_exec_time() == trans_R.get_exec_time()) {
-        // This is a min heap.
-        if (trans_L.get_trans_ID() < trans_R.get_trans_ID()) {
-            return false;
+    size_t size() const{
+      return count;
+    }
+    void push(const Transaction &trans){
+      uint32_t slot;
+      if (Free_Slots.empty()) {
+        slot = static_cast<uint32_t>(Slots.size());
+        Slots.push_back(trans);
+      }
+      else {
+        slot = Free_Slots.back();
+        Free_Slots.pop_back();
+        Slots[slot] = trans;
+      }
+      uint64_t bucket = trans.get_exec_time() / bucket_width;
+      if (count == 0) {
+        cursor = bucket;
+        last = bucket;
+      }
+      // The bound from place_transaction keeps this from happening, but if it ever did the ring is made large enough instead of losing order.
+      if (max(last, bucket) - min(cursor, bucket) >= Buckets.size()) {
+        grow(max(last, bucket) - min(cursor, bucket) + 1);
+      }
+      cursor = min(cursor, bucket);
+      last = max(last, bucket);
+      Entry entry = {trans.get_exec_time(), trans.get_trans_ID(), slot};
+      size_t index = bucket & (Buckets.size() - 1);
+      vector<Entry> &list = Buckets[index];
+      if (Sorted[index]) {
+        // A bucket that is already sorted keeps its largest entry first so that the smallest can be popped from the back.
+        list.insert(upper_bound(list.begin(), list.end(), entry, later), entry);
+      }
+      else {
+        list.push_back(entry);
+      }
+      count++;
+    }
+    // Appends every transaction with exec_time at or before now to batch, earliest first (ties broken by trans_ID), and removes them from the queue.
+    void pop_due(uint64_t now, vector<Transaction> &batch){
+      while (count > 0) {
+        vector<Entry> &list = current();
+        while (!list.empty() && list.back().exec_time <= now) {
+          batch.push_back(Slots[list.back().slot]);
+          Free_Slots.push_back(list.back().slot);
+          list.pop_back();
+          count--;
         }
-        else {
+        if (!list.empty()) {
+          return;
+        }
+        Sorted[cursor & (Buckets.size() - 1)] = 0;
+      }
+    }
+    // Calls visit on every pending transaction, in no particular order.
+    template <typename Visit>
+    void for_each(Visit visit) const{
+      for (const vector<Entry> &list : Buckets) {
+        for (const Entry &entry : list) {
+          visit(Slots[entry.slot]);
+        }
+      }
+    }
+  private:
+    struct Entry
+    {
+      uint64_t exec_time;
+      uint32_t trans_ID;
+      uint32_t slot;
+    };
+    // 4096 exec-time units per bucket and 1024 buckets cover about four million units, more than the three-day window.
+    static const uint64_t bucket_width = 4096;
+    static const size_t initial_buckets = 1024;
+    vector<vector<Entry>> Buckets;
+    // vector<bool> packs its elements into shared words, so the flags are kept as chars.
+    vector<char> Sorted;
+    vector<Transaction> Slots;
+    vector<uint32_t> Free_Slots;
+    // The bucket numbers (exec_time / bucket_width) of the earliest and latest possible pending transactions.
+    uint64_t cursor = 0;
+    uint64_t last = 0;
+    size_t count = 0;
+    static bool later(const Entry &left, const Entry &right){
+      if (left.exec_time != right.exec_time) {
+        return left.exec_time > right.exec_time;
+      }
+      return left.trans_ID > right.trans_ID;
+    }
+    // Moves the cursor to the first non-empty bucket and sorts it if this is the first time the cursor has reached it.
+    vector<Entry> &current(){
+      size_t index = cursor & (Buckets.size() - 1);
+      while (Buckets[index].empty()) {
+        cursor++;
+        index = cursor & (Buckets.size() - 1);
+      }
+      if (!Sorted[index]) {
+        sort(Buckets[index].begin(), Buckets[index].end(), later);
+        Sorted[index] = 1;
+      }
+      return Buckets[index];
+    }
+    // Rebuilds the ring with at least span buckets, keeping every entry in its bucket.
+    void grow(uint64_t span){
+      size_t size = Buckets.size();
+      while (size < span) {
+        size *= 2;
+      }
+      vector<vector<Entry>> Old_Buckets(size);
+      Old_Buckets.swap(Buckets);
+      Sorted.assign(size, 0);
+      for (vector<Entry> &list : Old_Buckets) {
+        for (const Entry &entry : list) {
+          Buckets[(entry.exec_time / bucket_width) & (size - 1)].push_back(entry);
+        }
+      }
+    }
+};
+
+/*
+ This struct is a read-only window over the most recent entries of a user's history.
+ Each entry is a position in the bank's queryList, so nothing is copied when a history is displayed.
+*/
+struct HistoryView
+{
+    const size_t* first;
+    const size_t* last;
+    // The total number of entries in the history, not just the ones in the window.
+    size_t total;
+    const size_t* begin() const{
+        return first;
+    }
+    const size_t* end() const{
+        return last;
+    }
+};
+
+/*
+ The set of IP addresses a user is logged in from, stored as the keys Bank::IP_key gives them.
+ Nearly every user has one or two sessions, so those live inline in the user without any allocation.
+ Only a user with more concurrent sessions spills into a sorted vector.
+ */
+class SessionSet
+{
+  public:
+    bool contains(uint64_t key) const{
+      if (Spill.empty()) {
+        for (uint32_t i = 0; i < count; ++i) {
+          if (Inline[i] == key) {
             return true;
+          }
         }
+        return false;
+      }
+      return binary_search(Spill.begin(), Spill.end(), key);
     }
-    else {
-        // Stand alone else branch here
-        return true;
+    void insert(uint64_t key){
+      if (contains(key)) {
+        return;
+      }
+      if (Spill.empty() && count < inline_capacity) {
+        Inline[count++] = key;
+        return;
+      }
+      if (Spill.empty()) {
+        Spill.assign(Inline, Inline + count);
+        sort(Spill.begin(), Spill.end());
+      }
+      Spill.insert(lower_bound(Spill.begin(), Spill.end(), key), key);
+      count++;
     }
-  }
+    void erase(uint64_t key){
+      if (Spill.empty()) {
+        for (uint32_t i = 0; i < count; ++i) {
+          if (Inline[i] == key) {
+            Inline[i] = Inline[--count];
+            return;
+          }
+        }
+        return;
+      }
+      auto it = lower_bound(Spill.begin(), Spill.end(), key);
+      if (it == Spill.end() || *it != key) {
+        return;
+      }
+      Spill.erase(it);
+      count--;
+      // Back down to a handful of sessions, they move inline again and the vector is freed.
+      if (count <= inline_capacity) {
+        copy(Spill.begin(), Spill.end(), Inline);
+        vector<uint64_t>().swap(Spill);
+      }
+    }
+    size_t size() const{
+      return count;
+    }
+    // Calls visit on every key, in no particular order.
+    template <typename Visit>
+    void for_each(Visit visit) const{
+      if (Spill.empty()) {
+        for_each_n(Inline, count, visit);
+      }
+      else {
+        for_each_n(Spill.begin(), Spill.size(), visit);
+      }
+    }
+  private:
+    static const uint32_t inline_capacity = 2;
+    // Zeroed so that copying a set never reads slots it has not filled.
+    uint64_t Inline[inline_capacity] = {};
+    uint32_t count = 0;
+    vector<uint64_t> Spill;
 };
 
 // This class manages information for each user of the 281 bank.
@@ -98,8 +604,10 @@ public:
      This constructor is used when loading user registration data from the account file.
      Remember the account file has lines in this format: REG_TIMESTAMP|USER_ID|PIN|STARTING_BALANCE.
     */
-    User(uint64_t timestamp, string user_ID, string pin, uint64_t balance)
-    : timestamp(timestamp), user_ID(user_ID), pin(pin), balance(balance) {}
+    // The histories take their memory from history, which is normally the bank's history pool.
+    // The ID and PIN are views; Bank::add_user moves them into the bank's name arena, so until then their text must stay put.
+    User(uint64_t timestamp, string_view user_ID, string_view pin, uint64_t balance, pmr::memory_resource* history = pmr::get_default_resource())
+    : timestamp(timestamp), user_ID(user_ID), pin(pin), balance(balance), outgoing(history), incoming(history) {}
     // Default Constructor
     User()
     : timestamp(0), user_ID("none"), pin("12345"), balance(0) {}
@@ -107,51 +615,67 @@ public:
     uint64_t get_start_time() const{
         return timestamp;
     }
-    string get_user_ID() const{
+    string_view get_user_ID() const{
         return user_ID;
     }
-    string get_pin() const{
+    string_view get_pin() const{
         return pin;
     }
+    // Points the ID and PIN at new copies of the same text.
+    void set_names(string_view new_user_ID, string_view new_pin){
+        user_ID = new_user_ID;
+        pin = new_pin;
+    }
     uint64_t get_balance() const{
         return balance;
     }
-    // Returns the IP address of the active session.
-    string get_active_sess() const{
+    // Returns the key of the IP address of the active session.
+    uint64_t get_active_sess() const{
         return active_user_sess;
     }
+    const SessionSet &get_IPs() const{
+        return IP_Addresses;
+    }
+    const pmr::vector<size_t> &get_outgoing() const{
+        return outgoing;
+    }
+    const pmr::vector<size_t> &get_incoming() const{
+        return incoming;
+    }
+    // Puts back the ledger indices saved in a snapshot.
+    void set_history(const vector<size_t> &new_outgoing, const vector<size_t> &new_incoming){
+        outgoing.assign(new_outgoing.begin(), new_outgoing.end());
+        incoming.assign(new_incoming.begin(), new_incoming.end());
+    }
     /*
      Sets activeUserSess which causes the session to be marked as active.
      When a user logs in sucessfully, this method updates their active session.
      By having an IP in activeUserSess, it indicates that the user has an ongoing (active) session
      */
-    void set_active_sess(const string &IP){
+    void set_active_sess(uint64_t IP){
         active_user_sess = IP;
     }
     /*
-     Adds new IP to IpAddresses, which is an unordered set.
+     Adds new IP to IpAddresses, which is a small set of IP keys.
      This data structure is crucial for verifying transactions quickly since only known IP addresses are valid
      */
-    void add_IP(const string &IPAddy){
+    void add_IP(uint64_t IPAddy){
         IP_Addresses.insert(IPAddy);
     }
     // This function is used when the user logs out to ensure only logged-in users with valid IPs can transact.
-    void remove_IP(const string &IP_Addy){
+    void remove_IP(uint64_t IP_Addy){
         IP_Addresses.erase(IP_Addy);
-        active_user_sess = "";
+        active_user_sess = no_session;
     }
     // This function is used to confirm that a transaction request is coming from a recognized IP; helping to prevent fraudulent transactions.
-    bool validate_IP(const string &IP_Addy) const{
-        if (IP_Addresses.find(IP_Addy) == IP_Addresses.end()) {
-            return false;
-        }
-        return true;
+    bool validate_IP(uint64_t IP_Addy) const{
+        return IP_Addresses.contains(IP_Addy);
     }
     /*
      Returns true if the user has at least one logged IP address, indicating an active session.
      This ensures users can only place transactions while logged in.
      */
-    bool is_logged_in(){
+    bool is_logged_in() const{
         if(IP_Addresses.size() >= 1) {
             return true;
         }
@@ -166,510 +690,2900 @@ public:
     void add_money(uint64_t amount){
         balance = balance + amount;
     }
-    // Adds a transaction to the outgoing vector, which stores a record of transactions the user has sent.
-    void add_outgoing(Transaction trans){
-        outgoing.push_back(trans);
+    // Adds a transaction to the outgoing vector, which stores the queryList positions of transactions the user has sent.
+    void add_outgoing(size_t ledger_index){
+        outgoing.push_back(ledger_index);
     }
-    // Adds a transaction to the incoming vector, which stores a record of transactions the user has received.
-    void add_incoming(Transaction trans){
-        incoming.push_back(trans);
+    // Adds a transaction to the incoming vector, which stores the queryList positions of transactions the user has received.
+    void add_incoming(size_t ledger_index){
+        incoming.push_back(ledger_index);
     }
-    vector<Transaction> get_outgoing(){
-        return outgoing;
+    // Returns a view of at most the count most recent outgoing transactions, oldest first.
+    HistoryView recent_outgoing(size_t count) const{
+        return recent(outgoing, count);
     }
-    vector<Transaction> get_incoming(){
-        return incoming;
+    // Returns a view of at most the count most recent incoming transactions, oldest first.
+    HistoryView recent_incoming(size_t count) const{
+        return recent(incoming, count);
     }
 private:
     uint64_t timestamp;
-    string user_ID;
-    string pin;
+    string_view user_ID;
+    string_view pin;
     uint64_t balance;
-    string active_user_sess;
-    unordered_set<string> IP_Addresses;
-    vector<Transaction> outgoing;
-    vector<Transaction> incoming;
+    // IP keys are at most 2^32 plus the number of distinct unusual IPs, so this value never names a real one.
+    static const uint64_t no_session = UINT64_MAX;
+    uint64_t active_user_sess = no_session;
+    SessionSet IP_Addresses;
+    pmr::vector<size_t> outgoing;
+    pmr::vector<size_t> incoming;
+    static HistoryView recent(const pmr::vector<size_t> &history, size_t count){
+        const size_t* last = history.data() + history.size();
+        return {last - min(count, history.size()), last, history.size()};
+    }
 };
 
-class Bank {
-    public:
-        // Bank constructor
-        Bank(bool verbose)
-          :verbose(verbose){
-            num_users = 0;
-            num_transactions = 0;
-            most_recent_timestamp = 0;
+/*
+ This class keeps a fixed set of worker threads for parallel loops.
+ run(count, task) calls task(i) for every i in [0, count) on the workers and the calling thread, and returns once every call has finished.
+ Each call to run gets its own job record, so a worker that wakes up late can never pick up work from a loop that has already moved on.
+*/
+class ThreadPool
+{
+  public:
+    // The pool uses num_threads threads in total, counting the thread that calls run.
+    explicit ThreadPool(size_t num_threads){
+      for (size_t i = 1; i < num_threads; ++i) {
+        Workers.emplace_back([this]() { work(); });
+      }
+    }
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    ~ThreadPool(){
+      {
+        lock_guard<mutex> lock(Lock);
+        stopping = true;
+      }
+      wake.notify_all();
+      for (thread &worker : Workers) {
+        worker.join();
+      }
+    }
+    size_t size() const{
+      return Workers.size() + 1;
+    }
+    void run(size_t count, const function<void(size_t)> &task){
+      if (Workers.empty() || count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+          task(i);
         }
-        size_t get_num_users(){
-          return num_users;
+        return;
+      }
+      shared_ptr<Job> job = make_shared<Job>(task, count);
+      {
+        lock_guard<mutex> lock(Lock);
+        Current = job;
+        generation++;
+      }
+      wake.notify_all();
+      do_tasks(*job);
+      unique_lock<mutex> lock(Lock);
+      finished.wait(lock, [&]() { return job->remaining == 0; });
+      Current.reset();
+    }
+  private:
+    struct Job
+    {
+      Job(const function<void(size_t)> &task, size_t total)
+      :task(task), total(total), remaining(total) {}
+      const function<void(size_t)> &task;
+      size_t total;
+      atomic<size_t> next{0};
+      atomic<size_t> remaining;
+    };
+    vector<thread> Workers;
+    mutex Lock;
+    condition_variable wake;
+    condition_variable finished;
+    shared_ptr<Job> Current;
+    uint64_t generation = 0;
+    bool stopping = false;
+    // Takes task indices from the job until there are none left; whoever finishes the last one wakes up run.
+    void do_tasks(Job &job){
+      for (size_t i = job.next++; i < job.total; i = job.next++) {
+        job.task(i);
+        if (job.remaining.fetch_sub(1) == 1) {
+          lock_guard<mutex> lock(Lock);
+          finished.notify_all();
         }
-        void add_user(User newUser){
-          /*
-           The variable myUsers is an unordered map where the key is user id and the object is user.
-           Both unordered_set and unordered_map are implemented as hash tables in C++.
-           They both use hash functions to organize and quickly retrieve elements, but unordered map stores key value pairs.
-          */
-          Users[newUser.get_user_ID()] = newUser;
-          num_users++;
+      }
+    }
+    void work(){
+      uint64_t seen = 0;
+      while (true) {
+        shared_ptr<Job> job;
+        {
+          unique_lock<mutex> lock(Lock);
+          wake.wait(lock, [&]() { return stopping || generation != seen; });
+          if (stopping) {
+            return;
+          }
+          seen = generation;
+          job = Current;
         }
-        User* get_user(const string &uID){
-          // Returning an address here.
-          return &Users[uID];
+        if (job) {
+          do_tasks(*job);
         }
-        bool login(const string &uID, const string &pin, string IP){
-          User* temp_user = get_user(uID);
-          if(pin == temp_user->get_pin()){
-            temp_user->set_active_sess(IP);
-            temp_user->add_IP(IP);
-            return true;
-          }
-          else {
-            // Returns false if failure.
-            return false;
-          }
+      }
+    }
+};
+
+/*
+ A snapshot is the whole state of a Bank in one binary file, in the byte order and layout of the machine that wrote it.
+ It starts with a SnapshotHeader and the large tables follow as raw arrays, so restoring them is a copy out of the mapped file.
+ */
+struct SnapshotHeader
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t num_users;
+    uint64_t user_count;
+    uint64_t num_transactions;
+    uint64_t most_recent_timestamp;
+    uint64_t pending_count;
+    uint64_t executed_count;
+    uint64_t other_IP_count;
+    uint64_t last_placement_time;
+};
+const char snapshot_magic[8] = {'2', '8', '1', 'B', 'A', 'N', 'K', '\0'};
+const uint64_t snapshot_version = 4;
+
+// Writes count values to out exactly as they are laid out in memory.
+template <typename T>
+void write_raw(OutputBuffer &out, const T* values, size_t count){
+    static_assert(is_trivially_copyable<T>::value, "only plain data can be written raw");
+    out << string_view(reinterpret_cast<const char*>(values), count * sizeof(T));
+}
+// Strings are written as their length followed by their characters.
+void write_string(OutputBuffer &out, string_view text){
+    uint64_t size = text.size();
+    write_raw(out, &size, 1);
+    out << text;
+}
+
+// Reads back what write_raw and write_string wrote. A read that would run past the end of the data fails and reads nothing.
+class SnapshotReader
+{
+  public:
+    explicit SnapshotReader(string_view data)
+    :data(data) {}
+    template <typename T>
+    bool read(T* values, size_t count){
+      static_assert(is_trivially_copyable<T>::value, "only plain data can be read raw");
+      if (count > data.size() / sizeof(T)) {
+        return false;
+      }
+      if (count > 0) {
+        memcpy(values, data.data(), count * sizeof(T));
+        data.remove_prefix(count * sizeof(T));
+      }
+      return true;
+    }
+    template <typename T>
+    bool read_vector(vector<T> &values, size_t count){
+      if (count > data.size() / sizeof(T)) {
+        return false;
+      }
+      values.resize(count);
+      return read(values.data(), count);
+    }
+    // The text is a view of the data, so it lasts only as long as the data does.
+    bool read_string(string_view &text){
+      uint64_t size;
+      if (!read(&size, 1) || size > data.size()) {
+        return false;
+      }
+      text = data.substr(0, size);
+      data.remove_prefix(size);
+      return true;
+    }
+    bool done() const{
+      return data.empty();
+    }
+    // The number of bytes not read yet.
+    size_t remaining() const{
+      return data.size();
+    }
+  private:
+    string_view data;
+};
+
+/*
+ How an operation turned out. Everything except Ok and Failed is the reason a balance or place command was turned down.
+ */
+enum class Outcome : uint8_t { Ok, Failed, MissingAccount, NotLoggedIn, Fraudulent, SelfTransfer, TooFar, MissingSender, MissingRecipient, NotRegistered };
+
+/*
+ One command from the operations section; the text fields are views of the command input.
+ Bank::resolve fills in the account indices, Bank::evaluate does the work that only touches one account's sessions, and
+ Bank::complete does everything that has to happen in command order. Running the three in a row is what the operations
+ loop in main does; ShardedEngine evaluates a whole batch of operations on several threads and completes them in order.
+ */
+struct Operation
+{
+    static constexpr uint32_t missing = UINT32_MAX;
+    // 'l' login, 'o' logout, 'b' balance or 'p' place.
+    char type = 0;
+    // The user for login, logout and balance, the sender for place.
+    string_view user;
+    // The recipient for place.
+    string_view other;
+    string_view pin;
+    string_view IP;
+    uint64_t time = 0;
+    uint64_t amount = 0;
+    uint64_t exec = 0;
+    FeePayer payer = FeePayer::Neither;
+    uint32_t user_index = missing;
+    uint32_t other_index = missing;
+    // The key of IP, filled in by Bank::resolve.
+    uint64_t IP_key = 0;
+    // Set when whoever read the operation has already filled in the indices and the IP key, so Bank::resolve leaves them alone.
+    bool resolved = false;
+};
+
+/*
+ Maps user IDs to their index in the bank's user table with open addressing over one flat array of slots.
+ Each slot keeps the name's hash next to the index, so a probe only compares names whose hashes match, and a lookup is a single
+ pass over neighbouring slots instead of a walk through separately allocated nodes. Lookups never insert.
+ The names are views; whoever inserts them keeps the characters alive for as long as the table.
+ */
+class AccountTable
+{
+  public:
+    // Returns the index stored for name, or Operation::missing.
+    uint32_t find(string_view name) const{
+      if (Slots.empty()) {
+        return Operation::missing;
+      }
+      uint64_t hash = hash_of(name);
+      for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const Slot &slot = Slots[i];
+        if (slot.index == Operation::missing) {
+          return Operation::missing;
         }
-        bool logout(const string &uID, string IP){
-          User* temp_user = get_user(uID);
-          if (temp_user->validate_IP(IP)) {
-            temp_user->remove_IP(IP);
-            return true;
-          }
-          else {
-              return false;
-          }
+        if (slot.hash == static_cast<uint32_t>(hash) && slot.name == name) {
+          return slot.index;
         }
-        void check_balance(const string &userID, const string &IP) {
-            // Checking if the user exists.
-            auto it = Users.find(userID);
-            if (it == Users.end()) {
-                if (verbose) {
-                    cout << "Account " << userID << " does not exist." << endl;
-                }
-                    return;
-            }
-            // Accessing second element in key-value pair.
-            User* user = &it->second;
-            // Check if the user is logged in
-            if (!user->is_logged_in()) {
-                if (verbose) {
-                    cout << "Account " << userID << " is not logged in." << endl;
-                }
-                return;
-            }
-            // Checking for fraudulent IP.
-            if (!user->validate_IP(IP)) {
-                if (verbose) {
-                    cout << "Fraudulent transaction detected, aborting request." << endl;
-                }
-                    return;
-            }
-            // Determining the timestamp to use: mostRecentTimestamp or registration timestamp.
-            uint64_t displayTimestamp = (most_recent_timestamp != 0) ? most_recent_timestamp : user->get_start_time();
-            // Displaying balance if all checks passed.
-            cout << "As of " << displayTimestamp << ", " << userID << " has a balance of $" << user->get_balance() << "." << endl;
+      }
+    }
+    // Adds name with index; name must not be in the table yet.
+    void insert(string_view name, uint32_t index){
+      if ((count + 1) * 2 > Slots.size()) {
+        rehash(max<size_t>(16, Slots.size() * 2));
+      }
+      place(name, hash_of(name), index);
+      count++;
+    }
+    // Makes room for count names in total without rehashing along the way.
+    void reserve(size_t total){
+      size_t wanted = 16;
+      while (wanted < total * 2) {
+        wanted *= 2;
+      }
+      if (wanted > Slots.size()) {
+        rehash(wanted);
+      }
+    }
+    size_t size() const{
+      return count;
+    }
+  private:
+    struct Slot
+    {
+      string_view name;
+      uint32_t hash = 0;
+      uint32_t index = Operation::missing;
+    };
+    // The table is never more than half full, so probe runs stay short. Its size is a power of two and mask is size - 1.
+    vector<Slot> Slots;
+    size_t mask = 0;
+    size_t count = 0;
+    static uint64_t hash_of(string_view name){
+      return hash<string_view>()(name);
+    }
+    void place(string_view name, uint64_t hash, uint32_t index){
+      size_t i = hash & mask;
+      while (Slots[i].index != Operation::missing) {
+        i = (i + 1) & mask;
+      }
+      Slots[i].name = name;
+      Slots[i].hash = static_cast<uint32_t>(hash);
+      Slots[i].index = index;
+    }
+    void rehash(size_t size){
+      vector<Slot> old(size);
+      old.swap(Slots);
+      mask = size - 1;
+      for (const Slot &slot : old) {
+        if (slot.index != Operation::missing) {
+          place(slot.name, hash_of(slot.name), slot.index);
         }
-        bool place_transaction(string &timestamp, string &IP, string &amount, string &exec_date, const string &feePayer, const string &sName, const string &rName){
-          // Establishing a limit of 3 days to ensure that the exec_date is not too far in the future.
-          uint64_t three_days = 3000000;
-          // Converts exec_date and timestamp into c style strings that are stored in a char pointer because of array decay.
-          const char* exec = exec_date.c_str();
-          const char* time = timestamp.c_str();
-          // Converting the c style strings into unit64_t integers.
-          uint64_t exec_num = strtoull(exec, NULL, 10);
-          uint64_t time_num = strtoull(time, NULL, 10);
-          // Setting mostRecentTimestamp to time of most recent place command.
-          most_recent_timestamp = time_num;
-          uint64_t difference = exec_num - time_num;
-          
-            
-          if (sName == rName) {
-              if (verbose) {
-                  cout << "Self transactions are not allowed." << "\n";
-              }
-              return false;
-          }
-            
-          
-          if(difference > three_days) {
-              if(verbose) {
-                  cout << "Select a time up to three days in the future." << "\n";
-              }
-              return false;
+      }
+    }
+};
+
+/*
+ A memory resource that passes every request on to upstream and counts it, for the allocator section of --stats.
+ Like the pmr pool and arena resources it sits in front of, it is not thread safe.
+ */
+class CountingResource : public pmr::memory_resource
+{
+  public:
+    struct Counts
+    {
+      uint64_t allocations = 0;
+      uint64_t deallocations = 0;
+      uint64_t bytes_allocated = 0;
+      uint64_t bytes_in_use = 0;
+      uint64_t peak_bytes = 0;
+    };
+    explicit CountingResource(pmr::memory_resource* upstream)
+    :upstream(upstream) {}
+    const Counts &counts() const{
+      return totals;
+    }
+  private:
+    pmr::memory_resource* upstream;
+    Counts totals;
+    void* do_allocate(size_t bytes, size_t alignment) override{
+      void* memory = upstream->allocate(bytes, alignment);
+      totals.allocations++;
+      totals.bytes_allocated += bytes;
+      totals.bytes_in_use += bytes;
+      totals.peak_bytes = max(totals.peak_bytes, totals.bytes_in_use);
+      return memory;
+    }
+    void do_deallocate(void* memory, size_t bytes, size_t alignment) override{
+      upstream->deallocate(memory, bytes, alignment);
+      totals.deallocations++;
+      totals.bytes_in_use -= bytes;
+    }
+    bool do_is_equal(const pmr::memory_resource &other) const noexcept override{
+      return this == &other;
+    }
+};
+
+// Returns the nanoseconds since start.
+inline uint64_t elapsed_ns(chrono::steady_clock::time_point start){
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+}
+
+/*
+ A latency histogram with one bucket per power of two nanoseconds.
+ Recording is a couple of relaxed atomic increments, so queries answered on several threads can share one histogram.
+ */
+class LatencyHistogram
+{
+  public:
+    void record(uint64_t ns){
+      // Bucket b holds latencies below 2^b nanoseconds and at or above 2^(b-1).
+      size_t bucket = 0;
+      while (bucket < 64 && (ns >> bucket) != 0) {
+        bucket++;
+      }
+      Buckets[bucket].fetch_add(1, memory_order_relaxed);
+      total_ns.fetch_add(ns, memory_order_relaxed);
+    }
+    uint64_t count() const{
+      uint64_t sum = 0;
+      for (const atomic<uint64_t> &bucket : Buckets) {
+        sum += bucket.load(memory_order_relaxed);
+      }
+      return sum;
+    }
+    // Writes the histogram as a JSON object. Percentiles are the upper bound of the bucket they fall in.
+    void write_json(ostream &report) const{
+      uint64_t total = count();
+      report << "{\"count\": " << total << ", \"total_ns\": " << total_ns.load(memory_order_relaxed)
+             << ", \"p50_ns\": " << percentile(total, 50) << ", \"p99_ns\": " << percentile(total, 99) << ", \"buckets\": [";
+      bool first = true;
+      for (size_t b = 0; b < Buckets.size(); ++b) {
+        uint64_t in_bucket = Buckets[b].load(memory_order_relaxed);
+        if (in_bucket != 0) {
+          report << (first ? "" : ", ") << "{\"below_ns\": " << upper_bound_of(b) << ", \"count\": " << in_bucket << '}';
+          first = false;
+        }
+      }
+      report << "]}";
+    }
+  private:
+    array<atomic<uint64_t>, 65> Buckets = {};
+    atomic<uint64_t> total_ns{0};
+    static uint64_t upper_bound_of(size_t bucket){
+      return bucket >= 64 ? UINT64_MAX : uint64_t(1) << bucket;
+    }
+    uint64_t percentile(uint64_t total, uint64_t percent) const{
+      uint64_t seen = 0;
+      for (size_t b = 0; b < Buckets.size(); ++b) {
+        seen += Buckets[b].load(memory_order_relaxed);
+        if (seen * 100 >= total * percent && seen > 0) {
+          return upper_bound_of(b);
+        }
+      }
+      return 0;
+    }
+};
+
+/*
+ What a run did, for --stats: how often each command ran and how it turned out, why places were turned down, how deep the
+ pending queue got, how long each kind of command and query took, and which customers issued the most operations.
+ Operations are recorded on the main thread; queries may be recorded from any thread.
+ */
+class Stats
+{
+  public:
+    void record_operation(const Operation &op, Outcome outcome, uint64_t ns){
+      size_t kind = operation_kind(op.type);
+      Outcomes[kind][static_cast<size_t>(outcome)]++;
+      Operation_Latency[kind].record(ns);
+      if (op.user_index != Operation::missing) {
+        if (User_Operations.size() <= op.user_index) {
+          User_Operations.resize(op.user_index + 1, 0);
+        }
+        User_Operations[op.user_index]++;
+      }
+    }
+    void record_query(char type, uint64_t ns){
+      Query_Latency[query_kind(type)].record(ns);
+    }
+    void record_pending(size_t depth){
+      pending_high_water = max(pending_high_water, depth);
+    }
+    void record_drain(size_t batch){
+      largest_drain = max(largest_drain, batch);
+    }
+    void record_insufficient_funds(){
+      insufficient_funds++;
+    }
+    // Records an allocator's counts: what was asked of it, and what it asked of the system in turn.
+    void record_allocator(const char* name, const CountingResource::Counts &requests, const CountingResource::Counts &upstream){
+      Allocators.push_back({name, requests, upstream});
+    }
+    // Writes the report as one JSON object. name_of turns a user index into the ID the user was looked up by.
+    template <typename NameOf>
+    void write_report(ostream &report, NameOf name_of) const{
+      static const char* const operation_names[] = {"login", "logout", "balance", "place"};
+      static const char* const outcome_names[] = {"ok", "failed", "unknown_account", "not_logged_in", "fraudulent_ip", "self_transfer",
+                                                  "beyond_three_days", "unknown_sender", "unknown_recipient", "unregistered"};
+      static const char* const query_names[] = {"list", "revenue", "history", "summary"};
+      report << "{\n  \"operations\": {";
+      for (size_t kind = 0; kind < 4; ++kind) {
+        report << (kind ? ",\n" : "\n") << "    \"" << operation_names[kind] << "\": {\"count\": " << Operation_Latency[kind].count() << ", \"outcomes\": {";
+        bool first = true;
+        for (size_t outcome = 0; outcome < outcome_count; ++outcome) {
+          if (Outcomes[kind][outcome] != 0) {
+            report << (first ? "" : ", ") << '"' << outcome_names[outcome] << "\": " << Outcomes[kind][outcome];
+            first = false;
+          }
+        }
+        report << "}, \"latency\": ";
+        Operation_Latency[kind].write_json(report);
+        report << '}';
+      }
+      const array<uint64_t, outcome_count> &place = Outcomes[3];
+      report << "\n  },\n  \"place_rejections\": {\"self_transfer\": " << place[size_t(Outcome::SelfTransfer)]
+             << ", \"beyond_three_days\": " << place[size_t(Outcome::TooFar)]
+             << ", \"unknown_sender\": " << place[size_t(Outcome::MissingSender)]
+             << ", \"unknown_recipient\": " << place[size_t(Outcome::MissingRecipient)]
+             << ", \"unregistered\": " << place[size_t(Outcome::NotRegistered)]
+             << ", \"not_logged_in\": " << place[size_t(Outcome::NotLoggedIn)]
+             << ", \"fraudulent_ip\": " << place[size_t(Outcome::Fraudulent)]
+             << ", \"insufficient_funds\": " << insufficient_funds << "},\n";
+      report << "  \"pending\": {\"high_water\": " << pending_high_water << ", \"largest_drain\": " << largest_drain << "},\n  \"queries\": {";
+      for (size_t kind = 0; kind < 4; ++kind) {
+        report << (kind ? ",\n" : "\n") << "    \"" << query_names[kind] << "\": ";
+        Query_Latency[kind].write_json(report);
+      }
+      report << "\n  },\n  \"top_customers\": [";
+      vector<uint32_t> order(User_Operations.size());
+      iota(order.begin(), order.end(), 0);
+      size_t shown = min<size_t>(top_customers, order.size());
+      partial_sort(order.begin(), order.begin() + static_cast<ptrdiff_t>(shown), order.end(), [this](uint32_t a, uint32_t b) {
+        return User_Operations[a] != User_Operations[b] ? User_Operations[a] > User_Operations[b] : a < b;
+      });
+      for (size_t i = 0; i < shown && User_Operations[order[i]] != 0; ++i) {
+        report << (i ? ", " : "") << "{\"user\": \"";
+        write_escaped(report, name_of(order[i]));
+        report << "\", \"operations\": " << User_Operations[order[i]] << '}';
+      }
+      report << "],\n  \"allocators\": {";
+      for (size_t i = 0; i < Allocators.size(); ++i) {
+        report << (i ? ",\n" : "\n") << "    \"" << Allocators[i].name << "\": {\"requests\": ";
+        write_counts(report, Allocators[i].requests);
+        report << ", \"upstream\": ";
+        write_counts(report, Allocators[i].upstream);
+        report << '}';
+      }
+      report << "\n  }\n}\n";
+    }
+  private:
+    static const size_t outcome_count = 10;
+    static constexpr size_t top_customers = 10;
+    array<array<uint64_t, outcome_count>, 4> Outcomes = {};
+    array<LatencyHistogram, 4> Operation_Latency;
+    array<LatencyHistogram, 4> Query_Latency;
+    vector<uint64_t> User_Operations;
+    size_t pending_high_water = 0;
+    size_t largest_drain = 0;
+    uint64_t insufficient_funds = 0;
+    struct AllocatorCounts
+    {
+      const char* name;
+      CountingResource::Counts requests;
+      CountingResource::Counts upstream;
+    };
+    vector<AllocatorCounts> Allocators;
+    static void write_counts(ostream &report, const CountingResource::Counts &counts){
+      report << "{\"allocations\": " << counts.allocations << ", \"deallocations\": " << counts.deallocations << ", \"bytes_allocated\": " << counts.bytes_allocated
+             << ", \"bytes_in_use\": " << counts.bytes_in_use << ", \"peak_bytes\": " << counts.peak_bytes << '}';
+    }
+    static size_t operation_kind(char type){
+      switch (type) {
+        case 'l': return 0;
+        case 'o': return 1;
+        case 'b': return 2;
+        default: return 3;
+      }
+    }
+    static size_t query_kind(char type){
+      switch (type) {
+        case 'l': return 0;
+        case 'r': return 1;
+        case 'h': return 2;
+        default: return 3;
+      }
+    }
+    // User IDs come straight from the input, so quotes, backslashes and control characters are escaped.
+    static void write_escaped(ostream &report, string_view text){
+      static const char hex[] = "0123456789abcdef";
+      for (char c : text) {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+          report << '\\' << c;
+        }
+        else if (u < 0x20) {
+          report << "\\u00" << hex[u >> 4] << hex[u & 15];
+        }
+        else {
+          report << c;
+        }
+      }
+    }
+};
+
+/*
+ The executed ledger, stored a column at a time: one array per field, every one in execution order.
+ A query reads only the columns it needs, so listing a window streams through exec times, amounts and accounts and nothing else.
+ Transactions execute in non-decreasing exec_time order, so the exec time column is sorted and is itself the index for exec-time windows.
+ */
+class Ledger
+{
+  public:
+    size_t size() const{
+      return Exec_Times.size();
+    }
+    void push_back(const Transaction &trans){
+      Exec_Times.push_back(trans.get_exec_time());
+      Amounts.push_back(trans.get_amount());
+      Fees.push_back(trans.get_fee());
+      Senders.push_back(trans.get_sender());
+      Recipients.push_back(trans.get_recepient());
+      Trans_IDs.push_back(trans.get_trans_ID());
+      // Fee_Prefix[i] is the revenue of the first i entries, so any slice is one subtraction.
+      Fee_Prefix.push_back(Fee_Prefix.back() + trans.get_fee());
+    }
+    uint64_t exec_time(size_t i) const{
+      return Exec_Times[i];
+    }
+    uint64_t amount(size_t i) const{
+      return Amounts[i];
+    }
+    uint32_t sender(size_t i) const{
+      return Senders[i];
+    }
+    uint32_t recipient(size_t i) const{
+      return Recipients[i];
+    }
+    uint32_t trans_ID(size_t i) const{
+      return Trans_IDs[i];
+    }
+    // The half-open range [first, last) of entries whose execution time lies in [start, end), found by two binary searches.
+    pair<size_t, size_t> exec_range(uint64_t start, uint64_t end) const{
+      auto first = lower_bound(Exec_Times.begin(), Exec_Times.end(), start);
+      auto last = lower_bound(first, Exec_Times.end(), max(start, end));
+      return {static_cast<size_t>(first - Exec_Times.begin()), static_cast<size_t>(last - Exec_Times.begin())};
+    }
+    // The fees collected by the entries in [first, last).
+    uint64_t fees(size_t first, size_t last) const{
+      return Fee_Prefix[last] - Fee_Prefix[first];
+    }
+    void save(OutputBuffer &file) const{
+      write_raw(file, Exec_Times.data(), Exec_Times.size());
+      write_raw(file, Amounts.data(), Amounts.size());
+      write_raw(file, Fees.data(), Fees.size());
+      write_raw(file, Senders.data(), Senders.size());
+      write_raw(file, Recipients.data(), Recipients.size());
+      write_raw(file, Trans_IDs.data(), Trans_IDs.size());
+      write_raw(file, Fee_Prefix.data(), Fee_Prefix.size());
+    }
+    // Reads back count entries that save wrote. Returns false if the data runs out.
+    bool load(SnapshotReader &reader, size_t count){
+      return reader.read_vector(Exec_Times, count)
+          && reader.read_vector(Amounts, count)
+          && reader.read_vector(Fees, count)
+          && reader.read_vector(Senders, count)
+          && reader.read_vector(Recipients, count)
+          && reader.read_vector(Trans_IDs, count)
+          && reader.read_vector(Fee_Prefix, count + 1);
+    }
+    /*
+     Checks what load cannot: that every account index is below user_count, every ID is one that was handed out, the exec
+     times are sorted and Fee_Prefix really totals Fees. Queries index users and binary search by these, so they must hold.
+    */
+    bool valid(size_t user_count, uint64_t num_transactions) const{
+      if (Fee_Prefix.empty() || Fee_Prefix[0] != 0) {
+        return false;
+      }
+      for (size_t i = 0; i < size(); ++i) {
+        if (Senders[i] >= user_count || Recipients[i] >= user_count || Trans_IDs[i] == 0 || Trans_IDs[i] > num_transactions) {
+          return false;
+        }
+        if ((i > 0 && Exec_Times[i] < Exec_Times[i - 1]) || Fee_Prefix[i + 1] != Fee_Prefix[i] + Fees[i]) {
+          return false;
+        }
+      }
+      return true;
+    }
+  private:
+    vector<uint64_t> Exec_Times;
+    vector<uint64_t> Amounts;
+    vector<uint64_t> Fees;
+    vector<uint32_t> Senders;
+    vector<uint32_t> Recipients;
+    vector<uint32_t> Trans_IDs;
+    // Running fee totals with a leading zero, so Fee_Prefix has one more entry than the other columns.
+    vector<uint64_t> Fee_Prefix = {0};
+};
+
+class Bank {
+    public:
+        // Bank constructor
+        // Everything the bank prints goes to out. With a thread pool, large batches of due transactions are settled in parallel.
+        Bank(bool verbose, OutputBuffer &out, ThreadPool* pool = nullptr)
+          :verbose(verbose), out(out), pool(pool){
+            num_users = 0;
+            num_transactions = 0;
+            most_recent_timestamp = 0;
+        }
+        size_t get_num_users(){
+          return num_users;
+        }
+        // Settlement and queueing are counted into stats from now on.
+        void set_stats(Stats* new_stats){
+          stats = new_stats;
+        }
+        // The ID that user index was interned under.
+        string_view get_name(uint32_t index) const{
+          return Names[index];
+        }
+        // Users made for this bank should take their history memory from here.
+        pmr::memory_resource* history_resource(){
+          return &History_Requests;
+        }
+        // Adds the counts of the bank's arenas to stats.
+        void report_allocators(Stats &report) const{
+          report.record_allocator("name_arena", Name_Requests.counts(), Name_Upstream.counts());
+          report.record_allocator("history_pool", History_Requests.counts(), History_Upstream.counts());
+        }
+        void add_user(User newUser){
+          /*
+           The variable User_IDs is a flat hash table where the key is user id and the value is the user's index in the Users vector.
+           Interning the names here means that everything after loading can reach account state by direct indexing.
+          */
+          uint32_t index = User_IDs.find(newUser.get_user_ID());
+          if (index == Operation::missing) {
+            // The ID is copied into the arena once, and the user, Names and User_IDs all share that one copy.
+            Names.push_back(copy_name(newUser.get_user_ID()));
+            newUser.set_names(Names.back(), copy_name(newUser.get_pin()));
+            User_IDs.insert(Names.back(), static_cast<uint32_t>(Users.size()));
+            Users.push_back(move(newUser));
+          }
+          else {
+            newUser.set_names(Names[index], copy_name(newUser.get_pin()));
+            Users[index] = move(newUser);
+          }
+          num_users++;
+        }
+        // Adds a whole batch of users in order; the tables are sized once up front instead of growing one user at a time.
+        void add_users(vector<User> &&batch){
+          Users.reserve(Users.size() + batch.size());
+          User_IDs.reserve(User_IDs.size() + batch.size());
+          for (User &newUser : batch) {
+            add_user(move(newUser));
+          }
+        }
+        User* get_user(uint32_t id){
+          return &Users[id];
+        }
+        // Returns the interned index of uID, or Operation::missing when nobody has that ID. Looking a user up never adds one.
+        uint32_t find_user(string_view uID) const{
+          return User_IDs.find(uID);
+        }
+        /*
+         Turns an IP address into the key sessions are stored under. A canonical IPv4 address is its own 32-bit value; any other
+         spelling is interned and numbered from 2^32 up, so it still only matches itself.
+        */
+        uint64_t IP_key(string_view IP){
+          uint32_t address;
+          if (parse_ipv4(IP, address)) {
+            return address;
+          }
+          auto it = Other_IPs.find(IP);
+          if (it != Other_IPs.end()) {
+            return it->second;
+          }
+          uint64_t key = (uint64_t(1) << 32) + Other_IP_Names.size();
+          Other_IP_Names.push_back(copy_name(IP));
+          Other_IPs.emplace(Other_IP_Names.back(), key);
+          return key;
+        }
+        /*
+         Looks up the accounts an operation names and the key of its IP. An unknown user ID is left as Operation::missing; it is
+         never added. Unusual IP spellings are interned, so this runs on one thread.
+        */
+        void resolve(Operation &op){
+          if (op.resolved) {
+            return;
+          }
+          if (!look_up(op)) {
+            op.IP_key = IP_key(op.IP);
+          }
+        }
+        /*
+         The read-only part of resolve: the account indices, and the key of a canonical IPv4 address. It may run on several threads
+         at once. Returns false when the IP is an unusual spelling, whose key only IP_key can hand out.
+        */
+        bool look_up(Operation &op) const{
+          op.user_index = find_user(op.user);
+          if (op.type == 'p') {
+            op.other_index = find_user(op.other);
+          }
+          uint32_t address;
+          if (parse_ipv4(op.IP, address)) {
+            op.IP_key = address;
+            return true;
+          }
+          return false;
+        }
+        /*
+         Does the part of an operation that only reads registrations and touches the sessions of op.user_index.
+         Nothing here prints or touches balances, so operations on different accounts can be evaluated on different threads,
+         as long as the operations on any one account are evaluated in command order.
+        */
+        Outcome evaluate(const Operation &op){
+          switch (op.type) {
+            case 'l':{
+              if (op.user_index == Operation::missing) {
+                return Outcome::MissingAccount;
+              }
+              User &user = Users[op.user_index];
+              if (op.pin != user.get_pin()) {
+                return Outcome::Failed;
+              }
+              user.set_active_sess(op.IP_key);
+              user.add_IP(op.IP_key);
+              return Outcome::Ok;
+            }
+            case 'o':{
+              if (op.user_index == Operation::missing) {
+                return Outcome::MissingAccount;
+              }
+              User &user = Users[op.user_index];
+              if (!user.validate_IP(op.IP_key)) {
+                return Outcome::Failed;
+              }
+              user.remove_IP(op.IP_key);
+              return Outcome::Ok;
+            }
+            case 'b':{
+              if (op.user_index == Operation::missing) {
+                return Outcome::MissingAccount;
+              }
+              User &user = Users[op.user_index];
+              if (!user.is_logged_in()) {
+                return Outcome::NotLoggedIn;
+              }
+              if (!user.validate_IP(op.IP_key)) {
+                return Outcome::Fraudulent;
+              }
+              return Outcome::Ok;
+            }
+            default:
+              return validate_place(op);
+          }
+        }
+        /*
+         Does the part of an operation that has to happen in command order: the verbose messages, the balance display and,
+         for a valid place, moving time forward and queueing the transaction. Returns true if the operation succeeded.
+        */
+        bool complete(const Operation &op, Outcome outcome){
+          switch (op.type) {
+            case 'l':
+              if (verbose) {
+                if (outcome == Outcome::Ok) {
+                  out << "User " << op.user << " logged in.\n";
+                }
+                else {
+                  out << "Login failed for " << op.user << ".\n";
+                }
+              }
+              return outcome == Outcome::Ok;
+            case 'o':
+              if (verbose) {
+                if (outcome == Outcome::Ok) {
+                  out << "User " << op.user << " logged out.\n";
+                }
+                else {
+                  out << "Logout failed for " << op.user << ".\n";
+                }
+              }
+              return outcome == Outcome::Ok;
+            case 'b':
+              return report_balance(op, outcome);
+            default:
+              return finish_place(op, outcome);
+          }
+        }
+        // Runs a whole operation on the calling thread.
+        bool apply(Operation &op){
+          resolve(op);
+          return complete(op, evaluate(op));
+        }
+        // Applies an operation read back from the write-ahead log. Nothing is printed; the run that logged it already did that.
+        bool replay(Operation &op){
+          bool was_verbose = verbose;
+          verbose = false;
+          bool done = apply(op);
+          verbose = was_verbose;
+          return done;
+        }
+        // The number of transactions placed but not yet executed.
+        size_t pending_count() const{
+          return Transactions.size();
+        }
+        size_t get_num_transactions() const{
+          return num_transactions;
+        }
+        // The number of transactions that have executed, which only grows.
+        size_t get_num_executed() const{
+          return Ledger_Entries.size();
+        }
+        // The time of the last valid place command, or 0 if there has not been one.
+        uint64_t last_placement_time() const{
+          return last_placement;
+        }
+        /*
+         Writes everything the bank knows to file: users with their balances, sessions and histories, the pending queue,
+         the executed ledger with its lookup tables, and the counters. See SnapshotHeader for the layout.
+        */
+        void save_snapshot(OutputBuffer &file) const{
+          vector<Transaction> pending;
+          pending.reserve(Transactions.size());
+          Transactions.for_each([&](const Transaction &trans) { pending.push_back(trans); });
+          SnapshotHeader header = {};
+          memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+          header.version = snapshot_version;
+          header.num_users = num_users;
+          header.user_count = Users.size();
+          header.num_transactions = num_transactions;
+          header.most_recent_timestamp = most_recent_timestamp;
+          header.pending_count = pending.size();
+          header.executed_count = Ledger_Entries.size();
+          header.other_IP_count = Other_IP_Names.size();
+          header.last_placement_time = last_placement;
+          write_raw(file, &header, 1);
+          write_raw(file, pending.data(), pending.size());
+          Ledger_Entries.save(file);
+          for (string_view IP : Other_IP_Names) {
+            write_string(file, IP);
+          }
+          for (size_t i = 0; i < Users.size(); ++i) {
+            const User &user = Users[i];
+            write_string(file, user.get_user_ID());
+            write_string(file, user.get_pin());
+            uint64_t fixed[6] = {user.get_start_time(), user.get_balance(), user.get_active_sess(), user.get_IPs().size(), user.get_outgoing().size(), user.get_incoming().size()};
+            write_raw(file, fixed, 6);
+            user.get_IPs().for_each([&file](uint64_t IP) { write_raw(file, &IP, 1); });
+            write_raw(file, user.get_outgoing().data(), user.get_outgoing().size());
+            write_raw(file, user.get_incoming().data(), user.get_incoming().size());
+          }
+        }
+        /*
+         Restores a bank that has nothing in it yet from a snapshot. Returns false if data is not a complete snapshot, or if any
+         account index, transaction ID or history position in it points outside the tables it was saved with.
+        */
+        bool load_snapshot(string_view data){
+          SnapshotReader reader(data);
+          SnapshotHeader header;
+          if (!reader.read(&header, 1) || memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0 || header.version != snapshot_version) {
+            return false;
+          }
+          // Account indices are 32 bits, with the largest value kept for Operation::missing.
+          if (header.user_count >= Operation::missing) {
+            return false;
+          }
+          vector<Transaction> pending;
+          if (!reader.read_vector(pending, header.pending_count) || !Ledger_Entries.load(reader, header.executed_count)) {
+            return false;
+          }
+          if (!Ledger_Entries.valid(header.user_count, header.num_transactions)) {
+            return false;
+          }
+          for (const Transaction &trans : pending) {
+            if (trans.get_sender() >= header.user_count || trans.get_recepient() >= header.user_count
+                || trans.get_trans_ID() == 0 || trans.get_trans_ID() > header.num_transactions) {
+              return false;
+            }
+            // Everything due by the last place was drained then, and nothing is placed more than three days ahead, so every
+            // pending exec time lies within three days after it. That also keeps the calendar queue's ring small.
+            if (trans.get_exec_time() < header.last_placement_time || trans.get_exec_time() - header.last_placement_time > 3000000) {
+              return false;
+            }
+          }
+          last_placement = header.last_placement_time;
+          for (uint64_t i = 0; i < header.other_IP_count; ++i) {
+            string_view IP;
+            if (!reader.read_string(IP)) {
+              return false;
+            }
+            Other_IP_Names.push_back(copy_name(IP));
+            Other_IPs.emplace(Other_IP_Names.back(), (uint64_t(1) << 32) + i);
+          }
+          for (const Transaction &trans : pending) {
+            Transactions.push(trans);
+          }
+          // Every user takes at least two string lengths and six fixed fields, so a count the rest of the data cannot hold is
+          // rejected before anything is sized by it.
+          const size_t min_user_size = 8 * sizeof(uint64_t);
+          if (header.user_count > reader.remaining() / min_user_size) {
+            return false;
+          }
+          Users.reserve(header.user_count);
+          User_IDs.reserve(header.user_count);
+          for (uint64_t i = 0; i < header.user_count; ++i) {
+            string_view user_ID, pin;
+            uint64_t fixed[6];
+            if (!reader.read_string(user_ID) || !reader.read_string(pin) || !reader.read(fixed, 6)) {
+              return false;
+            }
+            Names.push_back(copy_name(user_ID));
+            User user(fixed[0], Names.back(), copy_name(pin), fixed[1], history_resource());
+            user.set_active_sess(fixed[2]);
+            for (uint64_t j = 0; j < fixed[3]; ++j) {
+              uint64_t IP;
+              if (!reader.read(&IP, 1)) {
+                return false;
+              }
+              user.add_IP(IP);
+            }
+            vector<size_t> outgoing, incoming;
+            if (!reader.read_vector(outgoing, fixed[4]) || !reader.read_vector(incoming, fixed[5])) {
+              return false;
+            }
+            // History entries are positions in the executed ledger.
+            for (const vector<size_t> *history : {&outgoing, &incoming}) {
+              for (size_t position : *history) {
+                if (position >= header.executed_count) {
+                  return false;
+                }
+              }
+            }
+            user.set_history(outgoing, incoming);
+            User_IDs.insert(Names.back(), static_cast<uint32_t>(Users.size()));
+            Users.push_back(move(user));
+          }
+          num_users = header.num_users;
+          num_transactions = header.num_transactions;
+          most_recent_timestamp = header.most_recent_timestamp;
+          return reader.done();
+        }
+        bool has_transactions(){
+            if(Transactions.size() > 0) {
+                return true;
+            }
+            else {
+                return false;
+            }
+        }
+        /*
+         The function drain_until processes every pending transaction that is due at or before now.
+         The due transactions are taken out of the queue as one batch, already in (exec_time, trans_ID) order, and then settled one after another.
+        */
+        void drain_until(uint64_t now){
+          Due.clear();
+          Transactions.pop_due(now, Due);
+          if (stats) {
+            stats->record_drain(Due.size());
+          }
+          if (pool && pool->size() > 1 && Due.size() >= parallel_batch) {
+            settle_parallel();
+            return;
+          }
+          for (const Transaction &trans : Due) {
+            settle(trans);
+          }
+        }
+        /*
+         The settle_parallel function settles the batch in Due across the thread pool.
+         Two transactions conflict when they share an account, so the batch is split into groups of transactions connected through shared accounts (union-find).
+         Each group is settled by one thread in (exec_time, trans_ID) order, and groups never touch each other's balances, so the results are the same as settling
+         the whole batch in order. The messages and the ledger are then written in the original order.
+        */
+        void settle_parallel(){
+          size_t n = Due.size();
+          Group_Parent.resize(n);
+          iota(Group_Parent.begin(), Group_Parent.end(), 0);
+          // Account_Stamp marks the accounts already seen in this batch and Account_Last holds the last transaction that touched each one.
+          batch_stamp++;
+          if (Account_Stamp.size() < Users.size()) {
+            Account_Stamp.resize(Users.size(), 0);
+            Account_Last.resize(Users.size(), 0);
+          }
+          for (uint32_t i = 0; i < n; ++i) {
+            for (uint32_t account : {Due[i].get_sender(), Due[i].get_recepient()}) {
+              if (Account_Stamp[account] == batch_stamp) {
+                unite(i, Account_Last[account]);
+              }
+              Account_Stamp[account] = batch_stamp;
+              Account_Last[account] = i;
+            }
+          }
+          // Group_Start holds the offsets of each group in Group_Members, which lists the members of each group in batch order (a counting sort).
+          Group_Of.assign(n, UINT32_MAX);
+          Group_Start.clear();
+          Root_Group.assign(n, UINT32_MAX);
+          for (uint32_t i = 0; i < n; ++i) {
+            uint32_t root = find_group(i);
+            if (Root_Group[root] == UINT32_MAX) {
+              Root_Group[root] = static_cast<uint32_t>(Group_Start.size());
+              Group_Start.push_back(0);
+            }
+            Group_Of[i] = Root_Group[root];
+            Group_Start[Group_Of[i]]++;
+          }
+          size_t num_groups = Group_Start.size();
+          uint32_t offset = 0;
+          for (uint32_t &start : Group_Start) {
+            uint32_t size = start;
+            start = offset;
+            offset += size;
+          }
+          Group_Start.push_back(offset);
+          Group_Members.resize(n);
+          vector<uint32_t> next_slot(Group_Start.begin(), Group_Start.end() - 1);
+          for (uint32_t i = 0; i < n; ++i) {
+            Group_Members[next_slot[Group_Of[i]]++] = i;
+          }
+          // Each task takes a run of groups so that tiny groups do not cost one task each.
+          Executed.assign(n, 0);
+          size_t num_tasks = min(num_groups, pool->size() * 8);
+          pool->run(num_tasks, [&](size_t task) {
+            for (size_t g = num_groups * task / num_tasks; g < num_groups * (task + 1) / num_tasks; ++g) {
+              for (uint32_t k = Group_Start[g]; k < Group_Start[g + 1]; ++k) {
+                uint32_t i = Group_Members[k];
+                Executed[i] = apply_settlement(Due[i]);
+              }
+            }
+          });
+          for (size_t i = 0; i < n; ++i) {
+            report_settlement(Due[i], Executed[i]);
+          }
+        }
+        // At the end of the operations section every pending transaction is executed, whatever its exec_time.
+        void flush_pending(){
+          drain_until(UINT64_MAX);
+        }
+        /*
+         The calc_fee function works out the bank's fee for a transaction.
+         The transaction fee is calculated as 1% of the transaction amount, with a minimum of $10 and a maximum of $450.
+        */
+        static uint64_t calc_fee(uint64_t amount, uint64_t exec_time, uint64_t sender_start){
+          uint64_t fee = (amount * 1) / 100;
+          if (fee < 10) {
+              fee = 10;
+          }
+          else if (fee > 450) {
+              fee = 450;
+          }
+          // If the sender has been registered for more than 5 years, they receive a 25% discount on the fee.
+          // 50000000000) := 5 years
+          if ((exec_time - sender_start) >= 50000000000) {
+              fee = (fee * 3) / 4;
+          }
+          return fee;
+        }
+        // The settle function executes one due transaction, or rejects it if either party cannot pay, and returns whether it was executed.
+        bool settle(const Transaction &temp){
+          bool executed = apply_settlement(temp);
+          report_settlement(temp, executed);
+          return executed;
+        }
+        // The apply_settlement function moves the money for one transaction if both parties can pay; it only touches the two accounts involved.
+        bool apply_settlement(const Transaction &temp){
+          User* sender = get_user(temp.get_sender());
+          User* recepient = get_user(temp.get_recepient());
+          //o := sender, s := shared equally
+          uint64_t fee = temp.get_fee();
+          uint64_t s_fee = 0;
+          uint64_t r_fee = 0;
+          if (temp.get_fee_payer() == FeePayer::Sender) {
+            s_fee = fee;
+          }
+          else if (temp.get_fee_payer() == FeePayer::Shared) {//shared fee
+            r_fee = fee / 2;
+            s_fee = fee / 2;
+            //odd means sender pays the extra cent
+            if (fee % 2 != 0) {
+              s_fee++;
+            }
+          }
+          // The sender must have enough for the transaction amount plus their share of the fee, and the recipient must have enough for their share.
+          if (sender->get_balance() < (s_fee + temp.get_amount()) || recepient->get_balance() < r_fee) {
+              return false;
+          }
+          sender->remove_money(temp.get_amount() + s_fee);
+          recepient->remove_money(r_fee);
+          recepient->add_money(temp.get_amount());
+          return true;
+        }
+        // The report_settlement function prints the outcome of a settled transaction and records it in the ledger if it was executed.
+        void report_settlement(const Transaction &temp, bool executed){
+          if (!executed) {
+              if (stats) {
+                  stats->record_insufficient_funds();
+              }
+              if (verbose) {
+                  out << "Insufficient funds to process transaction " << (temp.get_trans_ID() - 1) << ".\n";
+              }
+              return;
+          }
+          if (verbose) {
+              out << "Transaction " << (temp.get_trans_ID() - 1) << " executed at " << temp.get_exec_time() << ": $" << temp.get_amount() << " from " << Users[temp.get_sender()].get_user_ID() << " to " << Users[temp.get_recepient()].get_user_ID() << ".\n";
+          }
+          record_executed(temp);
+        }
+        // The record_executed function adds an executed transaction to queryList and to every index built on it.
+        void record_executed(const Transaction &temp){
+          /*
+           queryList is a vector of Transactions that keeps a history of all executed transactions. Adding temp to queryList ensures that this transaction can be accessed
+           later for queries such as listing transactions within a specific time range or calculating bank revenue.
+           It is the only copy of the transaction; user histories refer to it by its position.
+          */
+          size_t ledger_index = Ledger_Entries.size();
+          Ledger_Entries.push_back(temp);
+          /*
+           The addOutgoing function records the transaction temp in the sender’s outgoing vector (a part of the User class). This allows the bank to retrieve a history
+           of all transactions sent by the user, which is useful for generating transaction summaries or account histories.
+          */
+          Users[temp.get_sender()].add_outgoing(ledger_index);
+          /*
+           The addIncoming function records temp in the recipient’s incoming vector (also part of the User class). This allows the recipient’s account to show a record of
+           all funds received, useful for query functions that generate account histories.
+          */
+          Users[temp.get_recepient()].add_incoming(ledger_index);
+        }
+        // Prints the ledger entry at position i, one line of a list or summary.
+        void print_executed(OutputBuffer &sink, size_t i) const{
+          uint64_t amount = Ledger_Entries.amount(i);
+          sink << (Ledger_Entries.trans_ID(i) - 1) << ": " << Users[Ledger_Entries.sender(i)].get_user_ID() << " sent " << amount << dollars(amount) << Users[Ledger_Entries.recipient(i)].get_user_ID() << " at " << Ledger_Entries.exec_time(i) << ".\n";
+        }
+        /*
+         The ListTransactions function in the Bank class is designed to display a list of transactions that occurred within a specified time range.
+         The function takes two times, start and end, which represent the time range for the transactions to be listed.
+         Each time is a timestamp in the format yy:mm:dd:hh:mm:ss already converted by parse_timestamp.
+        */
+        void list_transactions(OutputBuffer &sink, uint64_t start, uint64_t end) const{
+          // Checking if start and end times are the same
+          if (start == end) {
+              sink << "List Transactions requires a non-empty time interval.\n";
+              return;
+          }
+          // The variable count keeps track of how many transactions fall within the specified range.
+          int count = 0;
+          // Only the slice of queryList whose execution times fall in [start, end) is visited.
+          pair<size_t, size_t> range = Ledger_Entries.exec_range(start, end);
+          for(size_t i = range.first; i < range.second; ++i){
+            // we use numTransactions as transID it is indexed by 1 and we are formatting output to index 0
+            print_executed(sink, i);
+            count++;
+          }
+          if (count > 1 || count == 0) {
+            // Pluralizing transaction when it is appropriate to do so.
+            sink << "There were " << count << " transactions that were placed between time " << start << " to " << end << ".\n";
+          }
+          else {
+            sink << "There was " << count << " transaction that was placed between time " << start << " to " << end << ".\n";
+          }
+        }
+        /*
+         The calcRevenue function in the Bank class calculates the bank’s revenue from transaction fees over a specified time range
+         Both revenue queries go by execution time, so the matching transactions form one contiguous slice of the ledger and
+         their fees are one subtraction of the running totals.
+        */
+        uint64_t calc_revenue(uint64_t start, uint64_t end) const{
+          pair<size_t, size_t> range = Ledger_Entries.exec_range(start, end);
+          return Ledger_Entries.fees(range.first, range.second);
+        }
+        void bank_revenue(OutputBuffer &sink, uint64_t start, uint64_t end) const{
+          // Checking if start and end times are the same
+          if (start == end) {
+              sink << "Bank Revenue requires a non-empty time interval.\n";
+              return;
+          }
+          uint64_t revenue = calc_revenue(start, end);
+          uint64_t time = end - start;
+          static const string_view times[] = {"second", "minute", "hour", "day", "month", "year"};
+          // The loop extracts each component of time (e.g., seconds, minutes, etc.) by taking the last two digits; they are printed most significant first.
+          uint64_t nums[6] = {};
+          size_t units = 0;
+          while (time > 0 && units < 6) {
+            nums[units++] = time % 100;
+            // This line removes the last two digits from the time variable by use of integer division.
+            time /= 100;
+          }
+          sink << "281Bank has collected " << revenue << " dollars in fees over";
+          for (size_t i = units; i-- > 0;) {
+            if (nums[i] > 1) {
+                sink << ' ' << nums[i] << ' ' << times[i] << 's';
+            }
+            else if (nums[i] == 1) {
+                sink << ' ' << nums[i] << ' ' << times[i];
+            }
+          }
+          sink << ".\n";
+        }
+        /*
+         The CustomerHistory function in the Bank class displays a summary of a specific user’s account history, including their balance, total number of transactions, and
+         recent incoming and outgoing transactions
+        */
+        void customer_history(OutputBuffer &sink, string_view user) const{
+          // If user does not exist then find returns an iterator equal to myUsers.end(), which is a special iterator representing “one past the end” of the container.
+          uint32_t index = find_user(user);
+          if (index == Operation::missing) {
+            sink << "User " << user << " does not exist.\n";
+            return;
           }
-          
-            
-          // Ensuring that the sender exists.
-          if(Users.find(sName) == Users.end()) {
-              if(verbose) {
-                  cout << "Sender " << sName << " does not exist." << "\n";
-              }
-              return false;
+          const User* thisUser = &Users[index];
+          // Only the ten most recent transactions in each direction are displayed, so only those are looked at.
+          HistoryView tempin = thisUser->recent_incoming(10);
+          HistoryView tempout = thisUser->recent_outgoing(10);
+          sink << "Customer " << user << " account summary:\n";
+          sink << "Balance: $" << thisUser->get_balance() << '\n';
+          sink << "Total # of transactions: " << (tempin.total + tempout.total) << '\n';
+          sink << "Incoming " << tempin.total << ":\n";
+          for (size_t ledger_index : tempin) {
+            // The view holds ledger positions, and every column supports random access!
+            print_executed(sink, ledger_index);
           }
-          // Ensuring that the recipient exists.
-          if(Users.find(rName) == Users.end()) {
-              if(verbose) {
-                  cout << "Recipient " << rName << " does not exist." << "\n";
-              }
-              return false;
+          sink << "Outgoing " << tempout.total << ":\n";
+          for (size_t ledger_index : tempout) {
+            print_executed(sink, ledger_index);
           }
-          // getUser returns a user object address
-          User* sender = get_user(sName);
-          User* recepient = get_user(rName);
-          // The arrow operator is used to access member variables or member functions of a pointer.
-          string s_name = sender->get_user_ID();
-          string r_name = recepient->get_user_ID();
-          // Checking if the sender has registered.
-          if(exec_num < sender->get_start_time()) {
-              if(verbose) {
-                  cout << "At the time of execution, sender and/or recipient have not registered." << "\n";
-              }
-              return false;
+        }
+        // The SummarizeDay function in the Bank class provides a summary of all transactions that occurred within a specific day.
+        void summarize_day(OutputBuffer &sink, uint64_t time) const{
+          /*
+           The start of the day is calculated by setting the hour, minute, and second components to zero. This is done by subtracting the remainder when time is divided by
+           1000000.
+          */
+          uint64_t start = time - (time % 1000000);
+          // The end of the day is calculated by adding 1000000 to start, which adds 24 hours and represents the beginning of the following day.
+          uint64_t end = time - (time % 1000000) + 1000000;
+          sink << "Summary of [" << start << ", " << end << "):\n";
+          int count = 0;
+          // The variable queryList contains all of the executed transactions, the index narrows it down to this day.
+          pair<size_t, size_t> range = Ledger_Entries.exec_range(start, end);
+          for (size_t i = range.first; i < range.second; ++i) {
+            print_executed(sink, i);
+            count++;
           }
-          // Checking if the recepient has registered.
-          if(exec_num < recepient->get_start_time()) {
-              if(verbose) {
-                  cout << "At the time of execution, sender and/or recipient have not registered." << "\n";
-              }
-              return false;
+          if (count > 1 || count == 0) {
+            sink << "There were a total of " << count << " transactions, ";
           }
-          if(!sender->is_logged_in()) {
-              if(verbose) {
-                  cout << "Sender " << s_name << " is not logged in." << "\n";
-              }
-              return false;
+          else {
+            sink << "There was a total of " << count << " transaction, ";
+          }
+          uint64_t revenue = calc_revenue(start, end);
+          sink << "281Bank has collected " << revenue << " dollars in fees.\n";
+        }
+    private:
+        /*
+         Memory that lives as long as the bank. User IDs, PINs and unusual IPs never change or go away, so they are copied into a
+         monotonic arena that only ever hands out the next bytes of a large block. User histories grow and are reallocated,
+         so they come from a pool that recycles freed blocks by size. Each is counted on both sides: what the bank asks for,
+         and what the arena in turn asks of the system.
+        */
+        CountingResource Name_Upstream{pmr::new_delete_resource()};
+        pmr::monotonic_buffer_resource Name_Arena{1 << 16, &Name_Upstream};
+        CountingResource Name_Requests{&Name_Arena};
+        CountingResource History_Upstream{pmr::new_delete_resource()};
+        pmr::unsynchronized_pool_resource History_Pool{&History_Upstream};
+        CountingResource History_Requests{&History_Pool};
+        // Copies text into the name arena.
+        string_view copy_name(string_view text){
+          if (text.empty()) {
+            return string_view();
+          }
+          char* copy = static_cast<char*>(Name_Requests.allocate(text.size(), 1));
+          memcpy(copy, text.data(), text.size());
+          return string_view(copy, text.size());
+        }
+        // The checks on a place command, in the order the bank has always made them.
+        Outcome validate_place(const Operation &op){
+          // Establishing a limit of 3 days to ensure that the exec_date is not too far in the future.
+          uint64_t three_days = 3000000;
+          uint64_t difference = op.exec - op.time;
+          if (op.user == op.other) {
+              return Outcome::SelfTransfer;
+          }
+          if(difference > three_days) {
+              return Outcome::TooFar;
+          }
+          // Ensuring that the sender and then the recipient exist.
+          if(op.user_index == Operation::missing) {
+              return Outcome::MissingSender;
+          }
+          if(op.other_index == Operation::missing) {
+              return Outcome::MissingRecipient;
+          }
+          User &sender = Users[op.user_index];
+          // Checking if the sender and the recepient have registered.
+          if(op.exec < sender.get_start_time() || op.exec < Users[op.other_index].get_start_time()) {
+              return Outcome::NotRegistered;
+          }
+          if(!sender.is_logged_in()) {
+              return Outcome::NotLoggedIn;
           }
-          if(!sender->validate_IP(IP)) {
-              if(verbose) {
-                  cout << "Fraudulent transaction detected, aborting request." << "\n";
+          if(!sender.validate_IP(op.IP_key)) {
+              return Outcome::Fraudulent;
+          }
+          return Outcome::Ok;
+        }
+        bool report_balance(const Operation &op, Outcome outcome){
+            if (outcome != Outcome::Ok) {
+                if (verbose) {
+                    if (outcome == Outcome::MissingAccount) {
+                        out << "Account " << op.user << " does not exist.\n";
+                    }
+                    else if (outcome == Outcome::NotLoggedIn) {
+                        out << "Account " << op.user << " is not logged in.\n";
+                    }
+                    else {
+                        out << "Fraudulent transaction detected, aborting request.\n";
+                    }
+                }
+                return false;
+            }
+            const User &user = Users[op.user_index];
+            // Determining the timestamp to use: mostRecentTimestamp or registration timestamp.
+            uint64_t displayTimestamp = (most_recent_timestamp != 0) ? most_recent_timestamp : user.get_start_time();
+            // Displaying balance if all checks passed.
+            out << "As of " << displayTimestamp << ", " << op.user << " has a balance of $" << user.get_balance() << ".\n";
+            return true;
+        }
+        // Both times are already converted to yymmddhhmmss numbers by parse_timestamp.
+        bool finish_place(const Operation &op, Outcome outcome){
+          // Setting mostRecentTimestamp to time of most recent place command.
+          most_recent_timestamp = op.time;
+          if (outcome != Outcome::Ok) {
+              if (verbose) {
+                  switch (outcome) {
+                    case Outcome::SelfTransfer:
+                      out << "Self transactions are not allowed.\n";
+                      break;
+                    case Outcome::TooFar:
+                      out << "Select a time up to three days in the future.\n";
+                      break;
+                    case Outcome::MissingSender:
+                      out << "Sender " << op.user << " does not exist.\n";
+                      break;
+                    case Outcome::MissingRecipient:
+                      out << "Recipient " << op.other << " does not exist.\n";
+                      break;
+                    case Outcome::NotRegistered:
+                      out << "At the time of execution, sender and/or recipient have not registered.\n";
+                      break;
+                    case Outcome::NotLoggedIn:
+                      // The stored ID is printed here, not the one on the command.
+                      out << "Sender " << Users[op.user_index].get_user_ID() << " is not logged in.\n";
+                      break;
+                    default:
+                      out << "Fraudulent transaction detected, aborting request.\n";
+                      break;
+                  }
               }
               return false;
           }
+          const User &sender = Users[op.user_index];
           /*
-           Calling executeTransaction to process any pending transactions before adding a new one; this place order arrived in a new point in time.
+           Calling drain_until to process any pending transactions before adding a new one; this place order arrived in a new point in time.
            Because we moved foward in time, we have to check if any pending transactions are now due to execute.
            Timestamp is read in from spec-commands because place orders come with a timestamp.
           */
-          execute_transaction(timestamp);
-          const char* amt = amount.c_str();
-          uint64_t amt_num = strtoull(amt, NULL, 10);
+          drain_until(op.time);
           num_transactions++;
-          Transaction trans = Transaction(time_num, s_name, r_name, amt_num, exec_num, exec_date, feePayer, num_transactions);
-          // myTransactions a PQ.
+          Transaction trans = Transaction(op.time, op.user_index, op.other_index, op.amount, op.exec, op.payer, static_cast<uint32_t>(num_transactions));
+          // Everything the fee depends on is known now, so it is worked out once here rather than when the transaction comes due.
+          trans.set_fee(calc_fee(op.amount, op.exec, sender.get_start_time()));
+          // myTransactions is a calendar queue ordered by exec_time and then trans_ID.
           Transactions.push(trans);
+          if (stats) {
+              stats->record_pending(Transactions.size());
+          }
+          // Valid placements arrive in non-decreasing time order; the last one is where a restored run picks up the order check.
+          last_placement = op.time;
           if(verbose) {
-              cout << "Transaction " << (trans.get_trans_ID() - 1) << " placed at " << time_num << ": $" << amount << " from " << sender->get_user_ID() << " to " << recepient->get_user_ID() << " at " << exec_num << "." << "\n";
+              out << "Transaction " << (trans.get_trans_ID() - 1) << " placed at " << op.time << ": $" << op.amount << " from " << sender.get_user_ID() << " to " << Users[op.other_index].get_user_ID() << " at " << op.exec << ".\n";
           }
           return true;
         }
-        bool has_transactions(){
-            if(Transactions.size() > 0) {
+        // Pluralizing dollar when it is appropriate to do so; the spaces around it are part of the fragment.
+        static string_view dollars(uint64_t amount){
+            return (amount == 1) ? " dollar to " : " dollars to ";
+        }
+        /*
+         User_IDs maps each user id to the user's index; see AccountTable.
+         The keys are the views in Names, which point into the name arena, so looking up a name straight from the input does not build a string.
+        */
+        AccountTable User_IDs;// key is user id, value is index into Users
+        vector<string_view> Names;
+        // IP addresses that are not canonical IPv4, with their keys; see IP_key.
+        unordered_map<string_view, uint64_t> Other_IPs;
+        vector<string_view> Other_IP_Names;
+        vector<User> Users;
+        size_t num_users;
+        bool verbose;
+        OutputBuffer &out;
+        ThreadPool* pool;
+        Stats* stats = nullptr;
+        size_t num_transactions;
+        PendingQueue Transactions;
+        // The batch of due transactions being settled by drain_until; it is kept between calls so its storage is reused.
+        vector<Transaction> Due;
+        // Batches smaller than this are settled on the calling thread, where grouping them would cost more than it saves.
+        static const size_t parallel_batch = 1024;
+        // Scratch space for settle_parallel, also kept between batches.
+        vector<uint32_t> Group_Parent;
+        vector<uint32_t> Group_Of;
+        vector<uint32_t> Group_Start;
+        vector<uint32_t> Group_Members;
+        vector<uint32_t> Account_Stamp;
+        vector<uint32_t> Account_Last;
+        vector<uint32_t> Root_Group;
+        vector<char> Executed;
+        uint32_t batch_stamp = 0;
+        // Union-find over the batch, with path halving; the smaller index becomes the root.
+        uint32_t find_group(uint32_t i){
+          while (Group_Parent[i] != i) {
+            Group_Parent[i] = Group_Parent[Group_Parent[i]];
+            i = Group_Parent[i];
+          }
+          return i;
+        }
+        void unite(uint32_t a, uint32_t b){
+          a = find_group(a);
+          b = find_group(b);
+          if (a != b) {
+            Group_Parent[max(a, b)] = min(a, b);
+          }
+        }
+        // Every executed transaction, column by column in execution order; this was queryList.
+        Ledger Ledger_Entries;
+        uint64_t last_placement = 0;
+        uint64_t most_recent_timestamp;
+};
+
+/*
+ This class splits the command stream into whitespace separated tokens without copying them.
+ When stdin is a regular file (redirected with <) it is memory mapped; otherwise it is read in large blocks.
+ The tokens are views into the buffer and stay valid until the next call to next_token or next_fields.
+*/
+class CommandReader
+{
+  public:
+    explicit CommandReader(int fd)
+    :fd(fd){
+      struct stat info;
+      if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+        File = make_unique<MappedFile>(fd);
+        string_view text = File->contents();
+        data = text.data();
+        end = text.size();
+        eof = true;
+      }
+      else {
+        Buffer.resize(block_size);
+        data = Buffer.data();
+      }
+    }
+    // Reads commands from text, which has to stay valid for as long as the reader is used.
+    explicit CommandReader(string_view text)
+    :fd(-1), data(text.data()), end(text.size()), eof(true) {}
+    // Returns the next token, or an empty view once the input is exhausted.
+    string_view next_token(){
+      string_view token;
+      next_fields(&token, 1);
+      return token;
+    }
+    /*
+     Reads the next count tokens into fields, all at once so that they are all in the buffer together.
+     If the buffer runs out part way, more input is read and the fields are scanned again from the first one.
+     Returns false if the input ended first, in which case the missing fields are empty.
+    */
+    bool next_fields(string_view* fields, size_t count){
+      while (true) {
+        size_t start = pos;
+        size_t found = 0;
+        while (found < count) {
+          while (pos < end && is_space(data[pos])) {
+            ++pos;
+          }
+          size_t token_start = pos;
+          while (pos < end && !is_space(data[pos])) {
+            ++pos;
+          }
+          // A token that touches the end of the buffer may continue in the next block.
+          if (pos == end && !eof) {
+            break;
+          }
+          fields[found++] = string_view(data + token_start, pos - token_start);
+          if (pos == end) {
+            break;
+          }
+        }
+        if (found == count || eof) {
+          for (size_t i = found; i < count; ++i) {
+            fields[i] = string_view();
+          }
+          return found == count && !fields[count - 1].empty();
+        }
+        pos = start;
+        refill(start);
+      }
+    }
+    // Discards the rest of the current line, which is how comments are skipped.
+    void skip_line(){
+      while (true) {
+        const char* newline = static_cast<const char*>(memchr(data + pos, '\n', end - pos));
+        if (newline) {
+          pos = static_cast<size_t>(newline - data) + 1;
+          return;
+        }
+        pos = end;
+        if (!refill(pos)) {
+          return;
+        }
+      }
+    }
+    // Returns true if nothing but whitespace is left. Only a reader over text can say so without reading more.
+    bool at_end(){
+      while (pos < end && is_space(data[pos])) {
+        ++pos;
+      }
+      return pos == end && eof;
+    }
+    // Returns true if reading from the input failed, as opposed to simply reaching its end.
+    bool failed() const{
+      return read_error;
+    }
+  private:
+    static const size_t block_size = 1 << 20;
+    int fd;
+    unique_ptr<MappedFile> File;
+    vector<char> Buffer;
+    const char* data = nullptr;
+    size_t pos = 0;
+    size_t end = 0;
+    bool eof = false;
+    bool read_error = false;
+    static bool is_space(char c){
+      return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+    // Moves the unread bytes from keep onward to the front of the buffer and reads another block after them.
+    bool refill(size_t keep){
+      if (eof) {
+        return false;
+      }
+      memmove(Buffer.data(), Buffer.data() + keep, end - keep);
+      pos -= keep;
+      end -= keep;
+      if (end == Buffer.size()) {
+        Buffer.resize(Buffer.size() * 2);
+      }
+      data = Buffer.data();
+      ssize_t got = read(fd, Buffer.data() + end, Buffer.size() - end);
+      if (got <= 0) {
+        eof = true;
+        read_error = got < 0;
+        return false;
+      }
+      end += static_cast<size_t>(got);
+      return true;
+    }
+};
+
+// One query, from after $$$ or, in an online run, from among the operations. List and revenue queries use start and end, summaries use start as the day, and history uses user.
+struct Query
+{
+    char type = 0;
+    uint64_t start = 0;
+    uint64_t end = 0;
+    string_view user;
+};
+
+// Reads the fields of a query of the given type into query.
+void read_query_fields(CommandReader &commands, char type, Query &query){
+    query = Query();
+    query.type = type;
+    switch(type){
+        case 'l':
+        case 'r':{
+            string_view fields[2];
+            commands.next_fields(fields, 2);
+            query.start = parse_timestamp(fields[0]);
+            query.end = parse_timestamp(fields[1]);
+            break;
+        }
+        case 'h':{
+            query.user = commands.next_token();
+            break;
+        }
+        case 's':{
+            query.start = parse_timestamp(commands.next_token());
+            break;
+        }
+    }
+}
+
+// Reads the next query into query, skipping anything that is not one. Returns false at the end of the input.
+bool read_query(CommandReader &commands, Query &query){
+    string_view temp = commands.next_token();
+    while(!temp.empty()){
+        switch(temp[0]){
+            case 'l':
+            case 'r':
+            case 'h':
+            case 's':
+                read_query_fields(commands, temp[0], query);
                 return true;
+        }
+        temp = commands.next_token();
+    }
+    return false;
+}
+
+// What read_command found.
+enum class CommandKind : uint8_t { End, Operation, Query };
+
+/*
+ Reads the next command, skipping comment lines and anything that is not a command. An operation is read into op.
+ In an online run queries may come among the operations too, and are read into query. They are recognized by their first letter
+ as they are after $$$, except that a list query has to be just "l", since login starts with the same letter.
+ Returns CommandKind::End once the operations section ends, at $$$ or at the end of the input.
+ */
+CommandKind read_command(CommandReader &commands, Operation &op, Query &query, bool online){
+    op = Operation();
+    string_view temp = commands.next_token();
+    while(temp != "$$$" && !temp.empty()){
+        if (online && (temp == "l" || temp[0] == 'r' || temp[0] == 'h' || temp[0] == 's')) {
+            read_query_fields(commands, temp[0], query);
+            return CommandKind::Query;
+        }
+        op.type = temp[0];
+        switch(temp[0]){
+            case '#':{
+                commands.skip_line();
+                break;
             }
-            else {
-                return false;
+            case 'l':{
+                string_view fields[3];
+                commands.next_fields(fields, 3);
+                op.user = fields[0];
+                op.pin = fields[1];
+                op.IP = fields[2];
+                return CommandKind::Operation;
             }
+            case 'o':
+            case 'b':{
+                string_view fields[2];
+                commands.next_fields(fields, 2);
+                op.user = fields[0];
+                op.IP = fields[1];
+                return CommandKind::Operation;
+            }
+            case 'p':{
+                // The seven fields are timestamp, IP, sender, recipient, amount, exec_date and fee payer.
+                string_view fields[7];
+                commands.next_fields(fields, 7);
+                op.time = parse_timestamp(fields[0]);
+                op.IP = fields[1];
+                op.user = fields[2];
+                op.other = fields[3];
+                op.amount = parse_number(fields[4]);
+                op.exec = parse_timestamp(fields[5]);
+                op.payer = parse_fee_payer(fields[6]);
+                return CommandKind::Operation;
+            }
+        }
+        temp = commands.next_token();
+    }
+    return CommandKind::End;
+}
+
+/*
+ The binary command format, for command streams that are replayed many times: converting once with --convert saves tokenizing and
+ parsing every line again on each replay with --binary.
+ A file is a BinaryHeader, then a table of every distinct user ID, PIN and IP spelling in the stream, then one fixed-width BinaryCommand
+ per command in the order they came. The table holds the length of each name as a uint32_t, then all their characters back to back;
+ each part is padded to a multiple of eight bytes. Commands refer to names by their position in the table.
+ Like a snapshot, the file is in the byte order of the machine that wrote it.
+ */
+struct BinaryHeader
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t name_count;
+    uint64_t name_bytes;
+    uint64_t command_count;
+};
+const char binary_magic[8] = {'2', '8', '1', 'C', 'M', 'D', 'S', '\0'};
+const uint64_t binary_version = 1;
+
+// The kinds of record. End marks where $$$ was; queries before it were among the operations of an online stream.
+enum class BinaryType : uint8_t { Login, Logout, Balance, Place, End, List, Revenue, History, Summary };
+
+struct BinaryCommand
+{
+    static constexpr uint32_t no_name = UINT32_MAX;
+    // Set in flags when IPv4 holds the value of a canonical IPv4 address, so no text needs parsing.
+    static constexpr uint8_t has_IPv4 = 1;
+    BinaryType type;
+    FeePayer payer;
+    uint8_t flags;
+    uint8_t reserved;
+    // Positions in the name table, or no_name. A history query's user is in user.
+    uint32_t user;
+    uint32_t other;
+    uint32_t pin;
+    uint32_t IP;
+    uint32_t IPv4;
+    // The place time, or the start of a list, revenue or summary query.
+    uint64_t time;
+    uint64_t amount;
+    // The execution date, or the end of a list or revenue query.
+    uint64_t exec;
+};
+static_assert(sizeof(BinaryCommand) == 48, "BinaryCommand should pack into 48 bytes");
+
+/*
+ Reads a binary command stream from fd and hands out its commands like read_command does, with every operation already resolved
+ against myBank. Account indices are looked up once per name when the stream is opened, so nothing is hashed or parsed per command.
+ */
+class BinaryCommandReader
+{
+  public:
+    BinaryCommandReader(int fd, Bank &myBank)
+    :myBank(myBank) {
+      struct stat info;
+      string_view data;
+      if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+        File = make_unique<MappedFile>(fd);
+        data = File->contents();
+      }
+      else {
+        char block[1 << 16];
+        ssize_t got;
+        while ((got = read(fd, block, sizeof(block))) > 0) {
+          Contents.insert(Contents.end(), block, block + got);
+        }
+        data = string_view(Contents.data(), Contents.size());
+      }
+      valid = open(data);
+    }
+    // False if the input is not a complete binary command stream.
+    bool is_open() const{
+      return valid;
+    }
+    // Reads the next command into op or query. Returns CommandKind::End at the end marker and at the end of the stream.
+    CommandKind next(Operation &op, Query &query){
+      if (next_command == command_count) {
+        return CommandKind::End;
+      }
+      BinaryCommand record;
+      memcpy(&record, commands + next_command++ * sizeof(BinaryCommand), sizeof(record));
+      if (record.type < BinaryType::End) {
+        op = Operation();
+        op.type = "lobp"[static_cast<size_t>(record.type)];
+        op.user = name(record.user);
+        op.other = name(record.other);
+        op.pin = name(record.pin);
+        op.IP = name(record.IP);
+        op.time = record.time;
+        op.amount = record.amount;
+        op.exec = record.exec;
+        op.payer = (record.payer <= FeePayer::Shared) ? record.payer : FeePayer::Neither;
+        op.user_index = account(record.user);
+        op.other_index = (record.type == BinaryType::Place) ? account(record.other) : Operation::missing;
+        op.IP_key = (record.flags & BinaryCommand::has_IPv4) ? record.IPv4 : myBank.IP_key(op.IP);
+        op.resolved = true;
+        return CommandKind::Operation;
+      }
+      if (record.type > BinaryType::End && record.type <= BinaryType::Summary) {
+        query = Query();
+        query.type = "lrhs"[static_cast<size_t>(record.type) - static_cast<size_t>(BinaryType::List)];
+        query.start = record.time;
+        query.end = record.exec;
+        query.user = name(record.user);
+        return CommandKind::Query;
+      }
+      return CommandKind::End;
+    }
+    // Reads the next query after the end marker into query, like read_query. Returns false at the end of the stream.
+    bool next_query(Query &query){
+      Operation ignored;
+      while (next_command < command_count) {
+        if (next(ignored, query) == CommandKind::Query) {
+          return true;
+        }
+      }
+      return false;
+    }
+  private:
+    Bank &myBank;
+    unique_ptr<MappedFile> File;
+    vector<char> Contents;
+    bool valid = false;
+    vector<string_view> Names;
+    vector<uint32_t> Accounts;
+    const char* commands = nullptr;
+    size_t command_count = 0;
+    size_t next_command = 0;
+    static size_t padded(size_t size){
+      return (size + 7) & ~size_t(7);
+    }
+    string_view name(uint32_t id) const{
+      return (id < Names.size()) ? Names[id] : string_view();
+    }
+    uint32_t account(uint32_t id) const{
+      return (id < Accounts.size()) ? Accounts[id] : Operation::missing;
+    }
+    bool open(string_view data){
+      BinaryHeader header;
+      if (data.size() < sizeof(header)) {
+        return false;
+      }
+      memcpy(&header, data.data(), sizeof(header));
+      data.remove_prefix(sizeof(header));
+      if (memcmp(header.magic, binary_magic, sizeof(header.magic)) != 0 || header.version != binary_version
+          || header.name_count > data.size() / sizeof(uint32_t)) {
+        return false;
+      }
+      vector<uint32_t> lengths(header.name_count);
+      memcpy(lengths.data(), data.data(), lengths.size() * sizeof(uint32_t));
+      data.remove_prefix(min(data.size(), padded(lengths.size() * sizeof(uint32_t))));
+      if (header.name_bytes > data.size()) {
+        return false;
+      }
+      string_view characters = data.substr(0, header.name_bytes);
+      data.remove_prefix(min(data.size(), padded(header.name_bytes)));
+      Names.reserve(lengths.size());
+      Accounts.reserve(lengths.size());
+      for (uint32_t length : lengths) {
+        if (length > characters.size()) {
+          return false;
+        }
+        Names.push_back(characters.substr(0, length));
+        characters.remove_prefix(length);
+        Accounts.push_back(myBank.find_user(Names.back()));
+      }
+      if (header.command_count != data.size() / sizeof(BinaryCommand) || data.size() % sizeof(BinaryCommand) != 0) {
+        return false;
+      }
+      commands = data.data();
+      command_count = header.command_count;
+      return true;
+    }
+};
+
+/*
+ Converts the text command stream from commands into the binary format and writes it to file. With online set, queries among the
+ operations are kept as queries, as --online would read them. Returns the number of commands converted.
+ */
+size_t convert_commands(CommandReader &commands, OutputBuffer &file, bool online){
+    // The names are copied, because the reader may reuse its buffer for later input.
+    deque<string> Names;
+    unordered_map<string_view, uint32_t> Ids;
+    auto intern = [&](string_view text) {
+      auto it = Ids.find(text);
+      if (it != Ids.end()) {
+        return it->second;
+      }
+      Names.emplace_back(text);
+      uint32_t id = static_cast<uint32_t>(Names.size() - 1);
+      Ids.emplace(Names.back(), id);
+      return id;
+    };
+    vector<BinaryCommand> Records;
+    auto add_query = [&](const Query &query) {
+      BinaryCommand record = {};
+      record.type = (query.type == 'l') ? BinaryType::List : (query.type == 'r') ? BinaryType::Revenue : (query.type == 'h') ? BinaryType::History : BinaryType::Summary;
+      record.user = (query.type == 'h') ? intern(query.user) : BinaryCommand::no_name;
+      record.other = record.pin = record.IP = BinaryCommand::no_name;
+      record.time = query.start;
+      record.exec = query.end;
+      Records.push_back(record);
+    };
+    Operation op;
+    Query query;
+    CommandKind kind;
+    while ((kind = read_command(commands, op, query, online)) != CommandKind::End) {
+      if (kind == CommandKind::Query) {
+        add_query(query);
+        continue;
+      }
+      BinaryCommand record = {};
+      record.type = (op.type == 'l') ? BinaryType::Login : (op.type == 'o') ? BinaryType::Logout : (op.type == 'b') ? BinaryType::Balance : BinaryType::Place;
+      record.payer = op.payer;
+      record.user = intern(op.user);
+      record.other = (op.type == 'p') ? intern(op.other) : BinaryCommand::no_name;
+      record.pin = (op.type == 'l') ? intern(op.pin) : BinaryCommand::no_name;
+      record.IP = intern(op.IP);
+      if (parse_ipv4(op.IP, record.IPv4)) {
+        record.flags |= BinaryCommand::has_IPv4;
+      }
+      record.time = op.time;
+      record.amount = op.amount;
+      record.exec = op.exec;
+      Records.push_back(record);
+    }
+    BinaryCommand end = {};
+    end.type = BinaryType::End;
+    end.user = end.other = end.pin = end.IP = BinaryCommand::no_name;
+    Records.push_back(end);
+    while (read_query(commands, query)) {
+      add_query(query);
+    }
+    vector<uint32_t> lengths;
+    uint64_t name_bytes = 0;
+    for (const string &name : Names) {
+      lengths.push_back(static_cast<uint32_t>(name.size()));
+      name_bytes += name.size();
+    }
+    BinaryHeader header = {};
+    memcpy(header.magic, binary_magic, sizeof(header.magic));
+    header.version = binary_version;
+    header.name_count = Names.size();
+    header.name_bytes = name_bytes;
+    header.command_count = Records.size();
+    const char padding[8] = {};
+    write_raw(file, &header, 1);
+    write_raw(file, lengths.data(), lengths.size());
+    file << string_view(padding, (8 - lengths.size() * sizeof(uint32_t) % 8) % 8);
+    for (const string &name : Names) {
+      file << name;
+    }
+    file << string_view(padding, (8 - name_bytes % 8) % 8);
+    write_raw(file, Records.data(), Records.size());
+    return Records.size();
+}
+
+// The checks main makes on every place command before it reaches the bank. A failed check ends the program.
+struct PlaceOrder
+{
+    uint64_t prev_place_time = 0;
+    int placed = 0;
+    void check(const Operation &op) const{
+        const char* reason = problem(op);
+        if (reason) {
+            cerr << reason << endl;
+            exit(1);
+        }
+    }
+    // The reason op fails the checks, or nullptr if it passes. The server answers with the reason instead of exiting.
+    const char* problem(const Operation &op) const{
+        if (prev_place_time > op.time && placed != 0) {
+            return "Invalid decreasing timestamp in 'place' command.";
+        }
+        if (op.exec < op.time) {
+            return "You cannot have an execution date before the current timestamp.";
+        }
+        return nullptr;
+    }
+    // Called for every place the bank accepted.
+    void record(const Operation &op){
+        prev_place_time = op.time;
+        placed++;
+    }
+    // Picks up where the run that saved a snapshot left off; every transaction the bank has is one accepted place.
+    void resume(const Bank &myBank){
+        prev_place_time = myBank.last_placement_time();
+        placed = static_cast<int>(myBank.get_num_transactions());
+    }
+};
+
+/*
+ An append-only log of the operations that change the bank, written ahead of applying them.
+ Records are buffered and made durable together by commit, so a whole group of operations shares one fdatasync.
+ Settlements are not logged on their own: they follow from the operations, so replaying the operations settles the same transactions again.
+ Balance checks change nothing and are not logged either.
+ */
+class WriteAheadLog
+{
+  public:
+    // Opens the log at path, creating it if needed; is_open says whether that worked.
+    explicit WriteAheadLog(const string &path)
+    :fd(open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644)), file(fd) {}
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+    ~WriteAheadLog(){
+      if (fd >= 0) {
+        commit();
+        close(fd);
+      }
+    }
+    bool is_open() const{
+      return fd >= 0;
+    }
+    /*
+     Replays every complete record in the log onto myBank and returns how many there were.
+     Anything after the last complete record is what was being written when the previous run stopped; it is cut off so that new records follow straight on.
+    */
+    size_t recover(Bank &myBank, PlaceOrder &order){
+      MappedFile log(fd);
+      string_view data = log.contents();
+      size_t replayed = 0;
+      size_t valid = 0;
+      Record record;
+      while (data.size() - valid >= sizeof(Record)) {
+        memcpy(&record, data.data() + valid, sizeof(Record));
+        uint64_t text_size = uint64_t(record.user_size) + record.other_size + record.pin_size + record.IP_size;
+        if (text_size > data.size() - valid - sizeof(Record) || checksum(record, data.substr(valid + sizeof(Record), text_size)) != record.checksum) {
+          break;
+        }
+        const char* text = data.data() + valid + sizeof(Record);
+        Operation op;
+        op.type = record.type;
+        op.payer = record.payer;
+        op.time = record.time;
+        op.amount = record.amount;
+        op.exec = record.exec;
+        op.user = string_view(text, record.user_size);
+        text += record.user_size;
+        op.other = string_view(text, record.other_size);
+        text += record.other_size;
+        op.pin = string_view(text, record.pin_size);
+        text += record.pin_size;
+        op.IP = string_view(text, record.IP_size);
+        if (myBank.replay(op) && op.type == 'p') {
+          order.record(op);
+        }
+        valid += sizeof(Record) + text_size;
+        replayed++;
+      }
+      if (valid < data.size() && ftruncate(fd, static_cast<off_t>(valid)) != 0) {
+        cerr << "Write-ahead log could not be repaired." << endl;
+        exit(1);
+      }
+      return replayed;
+    }
+    // Adds op to the current group; a full group is committed straight away.
+    void append(const Operation &op){
+      Record record = {};
+      record.type = op.type;
+      record.payer = op.payer;
+      record.user_size = static_cast<uint32_t>(op.user.size());
+      record.other_size = static_cast<uint32_t>(op.other.size());
+      record.pin_size = static_cast<uint32_t>(op.pin.size());
+      record.IP_size = static_cast<uint32_t>(op.IP.size());
+      record.time = op.time;
+      record.amount = op.amount;
+      record.exec = op.exec;
+      record.checksum = checksum(record, op.user, op.other, op.pin, op.IP);
+      write_raw(file, &record, 1);
+      file << op.user << op.other << op.pin << op.IP;
+      if (++uncommitted == group_size) {
+        commit();
+      }
+    }
+    /*
+     Makes every appended record durable with a single fdatasync.
+     Operations are acknowledged on the strength of this, so if the records cannot be written or synced the run stops here.
+    */
+    void commit(){
+      if (uncommitted == 0) {
+        return;
+      }
+      if (!file.flush() || fdatasync(fd) != 0) {
+        cerr << "Write-ahead log could not be written." << endl;
+        exit(1);
+      }
+      uncommitted = 0;
+    }
+    // Empties the log once a snapshot holds everything in it. A log that cannot be emptied would be replayed onto that snapshot, so that stops the run too.
+    void clear(){
+      commit();
+      if (ftruncate(fd, 0) != 0 || fdatasync(fd) != 0) {
+        cerr << "Write-ahead log could not be emptied." << endl;
+        exit(1);
+      }
+    }
+  private:
+    struct Record
+    {
+      uint32_t checksum;
+      char type;
+      FeePayer payer;
+      uint16_t reserved;
+      uint32_t user_size;
+      uint32_t other_size;
+      uint32_t pin_size;
+      uint32_t IP_size;
+      uint64_t time;
+      uint64_t amount;
+      uint64_t exec;
+    };
+    static const size_t group_size = 4096;
+    int fd;
+    OutputBuffer file;
+    size_t uncommitted = 0;
+    // FNV-1a over the record (with its checksum field zeroed) and its text, so a torn or stale tail is recognised as such.
+    template <typename... Texts>
+    static uint32_t checksum(Record record, Texts... texts){
+      record.checksum = 0;
+      uint32_t hash = 2166136261u;
+      auto mix = [&hash](string_view bytes) {
+        for (char c : bytes) {
+          hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+        }
+      };
+      mix(string_view(reinterpret_cast<const char*>(&record), sizeof(Record)));
+      (mix(texts), ...);
+      return hash;
+    }
+};
+
+/*
+ Runs one operation on the calling thread, with the checks main makes on place commands.
+ With a log, the operation is logged before it is applied; with stats, it is counted and timed.
+ */
+void run_operation(Bank &myBank, PlaceOrder &order, Operation &op, WriteAheadLog* log, Stats* stats){
+    if (op.type == 'p') {
+        order.check(op);
+    }
+    if (log && op.type != 'b') {
+        log->append(op);
+    }
+    chrono::steady_clock::time_point start;
+    if (stats) {
+        start = chrono::steady_clock::now();
+    }
+    myBank.resolve(op);
+    Outcome outcome = myBank.evaluate(op);
+    bool done = myBank.complete(op, outcome);
+    if (stats) {
+        stats->record_operation(op, outcome, elapsed_ns(start));
+    }
+    if (done && op.type == 'p') {
+        order.record(op);
+    }
+}
+
+/*
+ Holds copies of command text for as long as a batch of operations is queued.
+ Text lives in fixed 1 MiB blocks that never move, so views into it stay valid until clear.
+ */
+class TextArena
+{
+  public:
+    string_view copy(string_view text){
+      // An empty view may have no data pointer at all, and nothing needs copying.
+      if (text.empty()) {
+        return string_view();
+      }
+      if (Blocks.empty() || used + text.size() > block_size) {
+        if (next_block == Blocks.size()) {
+          Blocks.push_back(make_unique<char[]>(max(block_size, text.size())));
+        }
+        else if (text.size() > block_size) {
+          Blocks[next_block] = make_unique<char[]>(text.size());
+        }
+        current = Blocks[next_block++].get();
+        used = 0;
+      }
+      char* start = current + used;
+      memcpy(start, text.data(), text.size());
+      used += text.size();
+      return string_view(start, text.size());
+    }
+    // Forgets every copy but keeps the blocks for the next batch.
+    void clear(){
+      next_block = 0;
+      used = block_size;
+    }
+  private:
+    static constexpr size_t block_size = 1 << 20;
+    vector<unique_ptr<char[]>> Blocks;
+    size_t next_block = 0;
+    char* current = nullptr;
+    size_t used = block_size;
+};
+
+/*
+ Runs the operations section with the accounts split into shards, each shard owned by one thread.
+ Operations are queued in batches. For each batch, the threads first look up the accounts and parse the IPs of a slice of the
+ batch each; the main thread only interns the unusual IP spellings and hands every operation to the shard of its account.
+ Every shard then evaluates the operations on its own accounts in command order, which covers logins, logouts and all the
+ session and registration checks; no two threads ever touch the same account's sessions.
+ The main thread then completes the batch in command order: it prints, and it settles and queues transactions, so the pending
+ queue, balances and output all see exactly the order they would on one thread.
+ */
+class ShardedEngine
+{
+  public:
+    ShardedEngine(Bank &myBank, ThreadPool &pool, PlaceOrder &order, WriteAheadLog* log, Stats* stats, size_t num_shards)
+    :myBank(myBank), pool(pool), order(order), log(log), stats(stats), Shards(max<size_t>(num_shards, 1)) {
+      Batch.reserve(batch_size);
+    }
+    // Queues an operation, running the batch once it is full. The command text is copied, so op may be reused straight away.
+    void add(const Operation &op){
+      Batch.push_back(op);
+      Operation &queued = Batch.back();
+      queued.user = Text.copy(op.user);
+      queued.other = Text.copy(op.other);
+      queued.pin = Text.copy(op.pin);
+      queued.IP = Text.copy(op.IP);
+      if (Batch.size() == batch_size) {
+        run_batch();
+      }
+    }
+    // Runs whatever is still queued.
+    void finish(){
+      run_batch();
+    }
+  private:
+    static constexpr size_t batch_size = 1 << 16;
+    // Accounts are spread over the shards by a multiplicative hash of their index; operations on unknown accounts touch no sessions.
+    size_t shard_of(uint32_t index) const{
+      if (index == Operation::missing) {
+        return 0;
+      }
+      return static_cast<size_t>((index * 0x9E3779B97F4A7C15ull) >> 32) % Shards.size();
+    }
+    void run_batch(){
+      if (Batch.empty()) {
+        return;
+      }
+      // Each thread resolves one contiguous slice of the batch; an operation whose IP still needs interning is marked in Unusual.
+      Unusual.assign(Batch.size(), 0);
+      size_t slice = (Batch.size() + Shards.size() - 1) / Shards.size();
+      pool.run(Shards.size(), [this, slice](size_t part) {
+        size_t end = min(Batch.size(), (part + 1) * slice);
+        for (size_t i = part * slice; i < end; ++i) {
+          if (!Batch[i].resolved && !myBank.look_up(Batch[i])) {
+            Unusual[i] = 1;
+          }
+        }
+      });
+      // Interning numbers new spellings, so it happens here in command order, exactly as it would on one thread.
+      for (size_t i = 0; i < Batch.size(); ++i) {
+        if (Unusual[i]) {
+          Batch[i].IP_key = myBank.IP_key(Batch[i].IP);
+        }
+        Shards[shard_of(Batch[i].user_index)].push_back(static_cast<uint32_t>(i));
+      }
+      Outcomes.resize(Batch.size());
+      // With stats, an operation's latency is the time its shard spent evaluating it plus the time spent completing it.
+      Evaluate_Times.resize(stats ? Batch.size() : 0);
+      pool.run(Shards.size(), [this](size_t shard) {
+        for (uint32_t i : Shards[shard]) {
+          if (stats) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            Outcomes[i] = myBank.evaluate(Batch[i]);
+            Evaluate_Times[i] = elapsed_ns(start);
+          }
+          else {
+            Outcomes[i] = myBank.evaluate(Batch[i]);
+          }
         }
-        // The function executeTransaction processes transactions in the priority queue up to the specified timestamp.
-        void execute_transaction(string &timestamp){
-          while(!Transactions.empty()){
-            const char* ctime = timestamp.c_str();
-            uint64_t current_time = strtoull(ctime, NULL, 10);
-            // The top() method retrieves the transaction with the highest priority (earliest execution time) from the priority queue.
-            Transaction temp = Transactions.top();
-            /*
-             The bool valid variable is used to track whether a transaction is eligible to be executed based on a series of checks (such as sufficient funds for both the
-             sender and recipient). If any of these checks fail, valid is set to false, preventing the transaction from being executed.
-            */
-            bool valid = true;
-              //  If the transaction’s execution time is greater than currentTime, it’s not yet ready to be processed, so the function returns early and does nothing.
-            if (temp.get_exec_time() > current_time) {
-                return;
-            }
-            //o := sender, s := shared equally
-            // The transaction fee is calculated as 1% of the transaction amount, with a minimum of $10 and a maximum of $450.
-            uint64_t fee = (temp.get_amount() * 1) / 100;
-            if (fee < 10) {
-                fee = 10;
-            }
-            else if (fee > 450) {
-                fee = 450;
-            }
-            // The variable temp is a Transaction object.
-            uint64_t exec_time = temp.get_exec_time();
-            User* sender = get_user(temp.get_sender());
-            User* recepient = get_user(temp.get_recepient());
-            // If the sender has been registered for more than 5 years, they receive a 25% discount on the fee.
-            // 50000000000) := 5 years
-            if ((exec_time - sender->get_start_time()) >= 50000000000) {
-                fee = (fee * 3) / 4;
-            }
-            uint64_t s_fee = 0;
-            uint64_t r_fee = 0;
-            if (temp.get_fee_payer() == "o") {
-              s_fee = fee;
-              r_fee = 0;
-            }
-            else if (temp.get_fee_payer() == "s") {//shared fee
-              r_fee = fee / 2;
-              s_fee = fee / 2;
-              //odd means sender pays the extra cent
-              if (fee % 2 != 0) {
-                s_fee++;
-              }
-            }
-            // The sender must have enough for the transaction amount plus their share of the fee.
-            if (sender->get_balance() < (s_fee + temp.get_amount())) {
-                if (verbose) {
-                    cout << "Insufficient funds to process transaction " << (temp.get_trans_ID() - 1) << "." << "\n";
-                }
-                // If either party lacks sufficient funds, the transaction is marked not valid and removed from the queue without executing.
-              Transactions.pop();
-              valid = false;
-            }
-            // The recipient must have enough for their share of the fee.
-            else if (recepient->get_balance() < r_fee) {
-                if (verbose) {
-                    cout << "Insufficient funds to process transaction " << (temp.get_trans_ID() - 1) << "." << "\n";
-                }
-                // If either party lacks sufficient funds, the transaction is marked not valid and removed from the queue without executing.
-              Transactions.pop();
-              valid = false;
-            }
-            if (valid) {
-              sender->remove_money(temp.get_amount() + s_fee);
-              recepient->remove_money(r_fee);
-              recepient->add_money(temp.get_amount());
-              if (verbose) {
-                  cout << "Transaction " << (temp.get_trans_ID() - 1) << " executed at " << temp.get_exec_time() << ": $" << temp.get_amount() << " from " << sender->get_user_ID() << " to " << recepient->get_user_ID() << "." << "\n";
-              }
+      });
+      for (size_t i = 0; i < Batch.size(); ++i) {
+        const Operation &op = Batch[i];
+        if (op.type == 'p') {
+          order.check(op);
+        }
+        if (log && op.type != 'b') {
+          log->append(op);
+        }
+        chrono::steady_clock::time_point start;
+        if (stats) {
+          start = chrono::steady_clock::now();
+        }
+        bool done = myBank.complete(op, Outcomes[i]);
+        if (stats) {
+          stats->record_operation(op, Outcomes[i], Evaluate_Times[i] + elapsed_ns(start));
+        }
+        if (done && op.type == 'p') {
+          order.record(op);
+        }
+      }
+      // The whole batch goes to disk as one group.
+      if (log) {
+        log->commit();
+      }
+      Batch.clear();
+      for (vector<uint32_t> &shard : Shards) {
+        shard.clear();
+      }
+      Text.clear();
+    }
+    Bank &myBank;
+    ThreadPool &pool;
+    PlaceOrder &order;
+    WriteAheadLog* log;
+    Stats* stats;
+    vector<vector<uint32_t>> Shards;
+    vector<Operation> Batch;
+    vector<char> Unusual;
+    vector<Outcome> Outcomes;
+    vector<uint64_t> Evaluate_Times;
+    TextArena Text;
+};
 
-              Transactions.pop();
-              temp.set_fee(fee);
-              /*
-               queryList is a vector of Transactions that keeps a history of all executed transactions. Adding temp to queryList ensures that this transaction can be accessed
-               later for queries such as listing transactions within a specific time range or calculating bank revenue.
-              */
-              Queries.push_back(temp);
-              /*
-               The addOutgoing function records the transaction temp in the sender’s outgoing vector (a part of the User class). This allows the bank to retrieve a history
-               of all transactions sent by the user, which is useful for generating transaction summaries or account histories.
-              */
-              sender->add_outgoing(temp);
-              /*
-               The addIncoming function records temp in the recipient’s incoming vector (also part of the User class). This allows the recipient’s account to show a record of
-               all funds received, useful for query functions that generate account histories.
-              */
-              recepient->add_incoming(temp);
-            }
+// Answers one query into sink. Queries only read the bank, so any number of them can run at once.
+void run_query(const Bank &myBank, OutputBuffer &sink, const Query &query){
+    switch(query.type){
+        case 'l':
+            myBank.list_transactions(sink, query.start, query.end);
+            break;
+        case 'r':
+            myBank.bank_revenue(sink, query.start, query.end);
+            break;
+        case 'h':
+            myBank.customer_history(sink, query.user);
+            break;
+        case 's':
+            myBank.summarize_day(sink, query.start);
+            break;
+    }
+}
+
+/*
+ Remembers the rendered answer to each distinct query. An answer is only good for the ledger it was rendered from, so whoever
+ runs the queries clears the cache once transactions have executed since.
+ Queries are normalized first: a summary is keyed by the start of its day, so every time within one day shares an answer.
+ Answers are looked up under a shared lock, so parallel queries only wait on each other when a new answer is stored.
+ */
+class QueryCache
+{
+  public:
+    // Writes the answer to query into sink, rendering it only the first time that query is asked.
+    void answer(const Bank &myBank, OutputBuffer &sink, const Query &query){
+      string key = key_of(query);
+      {
+        shared_lock<shared_mutex> lock(Lock);
+        auto it = Answers.find(key);
+        if (it != Answers.end()) {
+          hits++;
+          sink << it->second;
+          return;
+        }
+      }
+      misses++;
+      OutputBuffer rendered;
+      run_query(myBank, rendered, query);
+      sink << rendered.text();
+      unique_lock<shared_mutex> lock(Lock);
+      Answers.emplace(move(key), string(rendered.text()));
+    }
+    // Forgets every answer. Nothing else may use the cache meanwhile.
+    void clear(){
+      unique_lock<shared_mutex> lock(Lock);
+      Answers.clear();
+    }
+    uint64_t get_hits() const{
+      return hits;
+    }
+    uint64_t get_misses() const{
+      return misses;
+    }
+  private:
+    shared_mutex Lock;
+    unordered_map<string, string> Answers;
+    atomic<uint64_t> hits{0};
+    atomic<uint64_t> misses{0};
+    // The query type, the two normalized times as raw bytes, then the user ID for history queries.
+    static string key_of(const Query &query){
+      uint64_t times[2] = {query.start, query.end};
+      if (query.type == 's') {
+        times[0] -= times[0] % 1000000;
+      }
+      string key(1, query.type);
+      key.append(reinterpret_cast<const char*>(times), sizeof(times));
+      key.append(query.user);
+      return key;
+    }
+};
+
+// Answers query into sink, through the cache when there is one, and times it when there are stats.
+void answer_query(const Bank &myBank, OutputBuffer &sink, const Query &query, QueryCache* cache, Stats* stats){
+    chrono::steady_clock::time_point start;
+    if (stats) {
+      start = chrono::steady_clock::now();
+    }
+    if (cache) {
+      cache->answer(myBank, sink, query);
+    }
+    else {
+      run_query(myBank, sink, query);
+    }
+    if (stats) {
+      stats->record_query(query.type, elapsed_ns(start));
+    }
+}
+
+/*
+ Reads every remaining query and answers them on the pool. Consecutive queries are grouped into chunks; each chunk renders into
+ its own in-memory buffer, and the buffers are written to out in input order once every chunk is done.
+ Queries are read and answered in waves of a few chunks per thread, so only one wave's answers are ever held in memory at once.
+ */
+size_t run_queries_parallel(const Bank &myBank, ThreadPool &pool, const function<bool(Query&)> &next_query, OutputBuffer &out, QueryCache* cache, Stats* stats){
+    const size_t chunk_size = 256;
+    const size_t wave_size = chunk_size * 4 * pool.size();
+    vector<Query> Requests;
+    Requests.reserve(wave_size);
+    TextArena names;
+    vector<OutputBuffer> Parts((wave_size + chunk_size - 1) / chunk_size);
+    size_t total = 0;
+    Query query;
+    bool more = true;
+    while (more) {
+        while (Requests.size() < wave_size && (more = next_query(query))) {
+            // The reader may reuse its buffer for later input, so names are copied.
+            query.user = names.copy(query.user);
+            Requests.push_back(query);
+        }
+        size_t chunks = (Requests.size() + chunk_size - 1) / chunk_size;
+        pool.run(chunks, [&](size_t chunk) {
+          size_t last = min(Requests.size(), (chunk + 1) * chunk_size);
+          for (size_t i = chunk * chunk_size; i < last; ++i) {
+            answer_query(myBank, Parts[chunk], Requests[i], cache, stats);
           }
+        });
+        for (size_t chunk = 0; chunk < chunks; ++chunk) {
+            out << Parts[chunk].text();
+            Parts[chunk].clear();
         }
-        /*
-         The ListTransactions function in the Bank class is designed to display a list of transactions that occurred within a specified time range.
-         The function takes two string references, startTime and endTime, which represent the time range for the transactions to be listed.
-         Each timestamp is in the format yy:mm:dd:hh:mm:ss
-        */
-        void list_transactions(string &startTime, string &endTime){
-          // Ignoring all colons.
-          string temp_time_1 = startTime.substr(0,2) + startTime.substr(3,2) + startTime.substr(6,2) + startTime.substr(9,2) + startTime.substr(12,2) + startTime.substr(15,2);
-          const char* ctime_1 = temp_time_1.c_str();
-          uint64_t start = strtoull(ctime_1, NULL, 10);
-          string temp_time_2 = endTime.substr(0,2) + endTime.substr(3,2) + endTime.substr(6,2) + endTime.substr(9,2) + endTime.substr(12,2) + endTime.substr(15,2);
-          const char* ctime_2 = temp_time_2.c_str();
-          uint64_t end = strtoull(ctime_2, NULL, 10);
-          // Checking if start and end times are the same
-          if (start == end) {
-              cout << "List Transactions requires a non-empty time interval." << endl;
-              return;
+        out.flush();
+        total += Requests.size();
+        Requests.clear();
+        names.clear();
+    }
+    return total;
+}
+
+/*
+ Serves the bank to local clients over a Unix domain socket, on one thread with an epoll event loop.
+ A client sends commands one per line, the same operations and queries as an online run, and may send as many as it likes before reading any answers.
+ Each command is answered with its output followed by an empty line, in the order the commands arrived.
+ Everything that arrives in one pass of the loop is handled before any answer goes out, so the write-ahead log is committed once for the
+ whole pass and each client gets its answers in as few writes as possible. A client that stops reading its answers stops being read from,
+ so it cannot make the server hold an unbounded backlog. The server runs until it gets SIGINT or SIGTERM.
+ */
+class BankServer
+{
+  public:
+    explicit BankServer(const string &path)
+    :path(path) {
+      sockaddr_un address = {};
+      address.sun_family = AF_UNIX;
+      if (path.size() >= sizeof(address.sun_path)) {
+        return;
+      }
+      memcpy(address.sun_path, path.c_str(), path.size() + 1);
+      // A socket left behind by an earlier server is replaced, but nothing else at path is ever removed.
+      struct stat info;
+      if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(path.c_str());
+      }
+      int stop_pipe[2];
+      listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      epoll = epoll_create1(EPOLL_CLOEXEC);
+      if (listener < 0 || epoll < 0 || pipe2(stop_pipe, O_NONBLOCK | O_CLOEXEC) != 0
+          || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        return;
+      }
+      bound = true;
+      stop_read = stop_pipe[0];
+      stop_write = stop_pipe[1];
+      // The signal handler only writes a byte to the pipe, which wakes the loop wherever the signal was delivered.
+      struct sigaction action = {};
+      action.sa_handler = request_stop;
+      sigaction(SIGINT, &action, nullptr);
+      sigaction(SIGTERM, &action, nullptr);
+      watch(listener, EPOLLIN, EPOLL_CTL_ADD);
+      watch(stop_read, EPOLLIN, EPOLL_CTL_ADD);
+    }
+    BankServer(const BankServer &) = delete;
+    BankServer &operator=(const BankServer &) = delete;
+    ~BankServer(){
+      for (auto &entry : Clients) {
+        close(entry.first);
+      }
+      for (int fd : {listener, epoll, stop_read}) {
+        if (fd >= 0) {
+          close(fd);
+        }
+      }
+      if (bound) {
+        unlink(path.c_str());
+      }
+    }
+    bool is_open() const{
+      return bound;
+    }
+    /*
+     Runs until the server is told to stop. handle is given the complete lines a client has sent and appends their answers to reply;
+     after_pass runs once every pass, after all the input has been handled and before any answers are sent.
+    */
+    void run(const function<void(string_view, string&)> &handle, const function<void()> &after_pass){
+      epoll_event events[64];
+      bool stopping = false;
+      while (!stopping) {
+        int count = epoll_wait(epoll, events, 64, -1);
+        if (count < 0) {
+          if (errno == EINTR) {
+            continue;
           }
-          // The variable count keeps track of how many transactions fall within the specified range.
-          int count = 0;
-          // The loop iterates over each transaction in queryList, which is a vector of Transactions that stores all executed transactions.
-          for(size_t i = 0; i < Queries.size(); ++i){
-            Transaction* temp = &Queries[i];
-            uint64_t time = temp->get_exec_time();
-            if (start <= time && time < end) {
-              string d = "dollar";
-              if (temp->get_amount() > 1 || temp->get_amount() == 0) {
-                  // Pluralizing dollar when it is appropriate to do so.
-                  d += 's';
-              }
-              // we use numTransactions as transID it is indexed by 1 and we are formatting output to index 0
-            cout << (temp->get_trans_ID() - 1) << ": " << temp->get_sender() << " sent " << temp->get_amount() << " " << d << " to " << temp->get_recepient() << " at " << temp->get_exec_time() << "." << '\n';
-            count++;
-            }
+          break;
+        }
+        for (int i = 0; i < count; ++i) {
+          int fd = events[i].data.fd;
+          if (fd == listener) {
+            accept_clients();
           }
-          string t = "transaction";
-          if (count > 1 || count == 0) {
-            // Pluralizing transaction when it is appropriate to do so.
-            t += 's';
-            cout << "There were " << count <<  " " << t << " that were placed between time " << start << " to " << end << "." << '\n';
+          else if (fd == stop_read) {
+            stopping = true;
           }
           else {
-            cout << "There was " << count <<  " " << t << " that was placed between time " << start << " to " << end << "." << '\n';
-          }
-        }
-        /*
-         The calcRevenue function in the Bank class calculates the bank’s revenue from transaction fees over a specified time range
-         It iterates through the bank’s list of executed transactions (queryList) and sums up the fees for all transactions that occurred within the specified time window
-        */
-        uint64_t calc_revenue(uint64_t start, uint64_t end, bool isExec){
-          uint64_t revenue = 0;
-          for(size_t i = 0; i < Queries.size(); ++i){
-            Transaction* temp = &Queries[i];
-            uint64_t time = 0;
-            /*
-             IsExex is a boolean indicating whether to use the transaction’s execution time or placement time for comparison.
-             This choice gives additional flexibility in the revenue calculation.
-             It lets the function calculate revenue based on when transactions were placed or when they were executed.
-            */
-            if(isExec)
-              time = temp->get_exec_time();
-            else
-              time = temp->get_placement_time();
-            if(start <= time && time < end){
-              revenue += temp->get_fee();
+            Connection &client = Clients.at(fd);
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+              receive(client);
             }
+            Ready.push_back(fd);
           }
-          return revenue;
         }
-        void bank_revenue(string &startTime, string &endTime){
-          string temp_time_1 = startTime.substr(0,2) + startTime.substr(3,2) + startTime.substr(6,2) + startTime.substr(9,2) + startTime.substr(12,2) + startTime.substr(15,2);
-          const char* ctime_1 = temp_time_1.c_str();
-          uint64_t start = strtoull(ctime_1, NULL, 10);
-          string temp_time_2 = endTime.substr(0,2) + endTime.substr(3,2) + endTime.substr(6,2) + endTime.substr(9,2) + endTime.substr(12,2) + endTime.substr(15,2);
-          const char* ctime_2 = temp_time_2.c_str();
-          uint64_t end = strtoull(ctime_2, NULL, 10);
-          // Checking if start and end times are the same
-          if (start == end) {
-              cout << "Bank Revenue requires a non-empty time interval." << endl;
-              return;
+        for (int fd : Ready) {
+          Connection &client = Clients.at(fd);
+          if (backlog(client) <= max_backlog && !client.failed) {
+            handle_lines(client, handle);
           }
-          // Here isExec is set to true
-          uint64_t revenue = calc_revenue(start, end, true);
-          uint64_t time = end - start;
-          string output = "";
-          vector<string> times = {"second", "minute", "hour", "day", "month", "year"};
-          size_t i = 0;
-          while (time > 0) {
-            // The loop extracts each component of time (e.g., seconds, minutes, etc.) by taking the last two digits and appending the corresponding unit
-            uint64_t num = time % 100;
-            if (num > 1) {
-                output = to_string(num) + " " + times[i] + "s " + output;
-            }
-            else if (num == 1) {
-                output = to_string(num) + " " + times[i] + " " + output;
-            }
-            // This line removes the last two digits from the time variable by use of integer division.
-            time /= 100;
-            ++i;
+        }
+        after_pass();
+        for (int fd : Ready) {
+          auto it = Clients.find(fd);
+          if (it != Clients.end()) {
+            send_answers(it->second);
           }
-          // Removing the trailing space.
-        if (start != end) {
-            output.pop_back();
         }
-        cout << "281Bank has collected " << revenue << " dollars in fees over " << output << "." << '\n';
+        Ready.clear();
       }
-        /*
-         The CustomerHistory function in the Bank class displays a summary of a specific user’s account history, including their balance, total number of transactions, and
-         recent incoming and outgoing transactions
-        */
-        void customer_history(string &user){
-          // If user does not exist then find returns an iterator equal to myUsers.end(), which is a special iterator representing “one past the end” of the container.
-          if (Users.find(user) == Users.end()) {
-            cout << "User " << user << " does not exist." << '\n';
+    }
+  private:
+    struct Connection
+    {
+      int fd;
+      // Input not yet handled, which ends part way through a line, and answers not yet sent, from sent onward.
+      string In;
+      string Out;
+      size_t sent = 0;
+      // The client has finished sending, or the connection broke.
+      bool finished = false;
+      bool failed = false;
+      uint32_t interest = EPOLLIN | EPOLLRDHUP;
+    };
+    // Past this many unsent bytes of answers, a client's input is left unread until it catches up.
+    static constexpr size_t max_backlog = 1 << 22;
+    static inline int stop_write = -1;
+    string path;
+    int listener = -1;
+    int epoll = -1;
+    int stop_read = -1;
+    bool bound = false;
+    unordered_map<int, Connection> Clients;
+    vector<int> Ready;
+    static void request_stop(int){
+      char byte = 0;
+      ssize_t wrote = write(stop_write, &byte, 1);
+      (void)wrote;
+    }
+    void watch(int fd, uint32_t interest, int change){
+      epoll_event event = {};
+      event.events = interest;
+      event.data.fd = fd;
+      epoll_ctl(epoll, change, fd, &event);
+    }
+    static size_t backlog(const Connection &client){
+      return client.Out.size() - client.sent;
+    }
+    void accept_clients(){
+      while (true) {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+          return;
+        }
+        Connection &client = Clients[fd];
+        client.fd = fd;
+        watch(fd, client.interest, EPOLL_CTL_ADD);
+      }
+    }
+    void receive(Connection &client){
+      char block[1 << 16];
+      while (!client.finished) {
+        ssize_t got = read(client.fd, block, sizeof(block));
+        if (got > 0) {
+          client.In.append(block, static_cast<size_t>(got));
+          // Reading stops at the limit too; the rest is read once the lines so far have been handled.
+          if (client.In.size() > max_backlog) {
             return;
           }
-          User* thisUser = get_user(user);
-          // The member function getIncoming() retrieves a vector of all transactions in which this user is the recipient.
-          vector<Transaction> tempin = thisUser->get_incoming();
-          // The member function getOutgoing() retrieves a vector of all transactions where this user is the sender.
-          vector<Transaction> tempout = thisUser->get_outgoing();
-          cout << "Customer " << user << " account summary:" << '\n';
-          cout << "Balance: $" << thisUser->get_balance() << '\n';
-          cout << "Total # of transactions: " << (tempin.size() + tempout.size()) << '\n';
-          // The expression temp.size() is used multiple times so create a variable for it.
-          size_t insize = tempin.size();
-          cout << "Incoming " << insize << ":" << '\n';
-          size_t start = 0;
-          // Displaying the ten most recent incoming transactions.
-          if (insize > 10) {
-              start = insize - 10;
-          }
-          while (start < insize) {
-          // Vectors support random access!
-            Transaction* temp = &tempin[start];
-            string d = "dollar";
-            if (temp->get_amount() > 1 || temp->get_amount() == 0) {
-                d += "s";
-            }
-            cout << (temp->get_trans_ID() - 1) << ": " << temp->get_sender() << " sent " << temp->get_amount() << " " << d << " to " << user << " at " << temp->get_exec_time() << "." << '\n';
-            start++;
-          }
-          size_t outsize = tempout.size();
-          cout << "Outgoing " << outsize << ":" << '\n';
-          start = 0;
-          if (outsize > 10) {
-              start = outsize - 10;
-          }
-          while(start < outsize){
-            Transaction* temp = &tempout[start];
-            string d = "dollar";
-            if(temp->get_amount() > 1 || temp->get_amount() == 0)
-              d += "s";
-            cout << (temp->get_trans_ID() - 1) << ": " << user << " sent " << temp->get_amount() << " " << d << " to " << temp->get_recepient() << " at " << temp->get_exec_time() << "." << '\n';
-            start++;
-          }
         }
-        // The SummarizeDay function in the Bank class provides a summary of all transactions that occurred within a specific day.
-        void summarize_day(string timestamp){
-          timestamp = timestamp.substr(0,2) + timestamp.substr(3,2) + timestamp.substr(6,2) + timestamp.substr(9,2) + timestamp.substr(12,2) + timestamp.substr(15,2);
-          const char* ctime = timestamp.c_str();
-          uint64_t time = strtoull(ctime, NULL, 10);
-          /*
-           The start of the day is calculated by setting the hour, minute, and second components to zero. This is done by subtracting the remainder when time is divided by
-           1000000.
-          */
-          uint64_t start = time - (time % 1000000);
-          // The end of the day is calculated by adding 1000000 to start, which adds 24 hours and represents the beginning of the following day.
-          uint64_t end = time - (time % 1000000) + 1000000;
-          cout << "Summary of [" << start << ", " << end << "):" << '\n';
-          int count = 0;
-          // The variable queryList contains all of the executed transactions.
-          for (size_t i = 0; i < Queries.size(); ++i) {
-            Transaction* temp = &Queries[i];
-            uint64_t time = temp->get_exec_time();
-            if (start <= time && time < end) {
-              string d = "dollar";
-              if (temp->get_amount() > 1 || temp->get_amount() == 0) {
-                  d += 's';
-              }
-              cout << (temp->get_trans_ID() - 1) << ": " << temp->get_sender() << " sent " << temp->get_amount() << " " << d << " to " << temp->get_recepient() << " at " << temp->get_exec_time() << "." << '\n';
-              count++;
-            }
-          }
-          string t = "";
-          if (count > 1 || count == 0) {
-            t += "There were a total of " + to_string(count) + " transactions, ";
-          }
-          else {
-            t += "There was a total of " + to_string(count) + " transaction, ";
+        else if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+          if (errno != EINTR) {
+            return;
           }
-          uint64_t revenue = calc_revenue(start, end, true);
-          t += "281Bank has collected " + to_string(revenue) + " dollars in fees.";
-          cout << t << '\n';
         }
-    private:
-        // The data structure unordered_map stores a key-value pair where the key is the user id and the object is the user.
-        unordered_map<string, User> Users;// key is user id, object is user
-        size_t num_users;
-        bool verbose;
-        size_t num_transactions;
-        priority_queue<Transaction, vector<Transaction>, TransactionCompare> Transactions;
-        vector<Transaction> Queries;
-        uint64_t most_recent_timestamp;
+        else {
+          client.finished = true;
+          client.failed = got < 0;
+        }
+      }
+    }
+    // Hands every complete line to handle. Once the client has finished sending, a last line without a newline counts too.
+    void handle_lines(Connection &client, const function<void(string_view, string&)> &handle){
+      size_t cut = client.In.rfind('\n');
+      size_t size = (cut == string::npos) ? 0 : cut + 1;
+      if (client.finished) {
+        size = client.In.size();
+      }
+      if (size == 0) {
+        // A line longer than the backlog limit will never be handled, so the client is dropped rather than read forever.
+        client.failed = client.In.size() > max_backlog;
+        return;
+      }
+      handle(string_view(client.In.data(), size), client.Out);
+      client.In.erase(0, size);
+    }
+    // Sends what it can without blocking, then closes the connection or changes what it waits for.
+    void send_answers(Connection &client){
+      while (!client.failed && backlog(client) > 0) {
+        ssize_t wrote = send(client.fd, client.Out.data() + client.sent, backlog(client), MSG_NOSIGNAL);
+        if (wrote < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          break;
+        }
+        if (wrote < 0 && errno == EINTR) {
+          continue;
+        }
+        if (wrote <= 0) {
+          client.failed = true;
+          break;
+        }
+        client.sent += static_cast<size_t>(wrote);
+      }
+      if (backlog(client) == 0) {
+        client.Out.clear();
+        client.sent = 0;
+      }
+      if (client.failed || (client.finished && client.In.empty() && backlog(client) == 0)) {
+        epoll_ctl(epoll, EPOLL_CTL_DEL, client.fd, nullptr);
+        close(client.fd);
+        Clients.erase(client.fd);
+        return;
+      }
+      // Wait to read only while the backlog is small, and to write only while there is a backlog.
+      uint32_t interest = 0;
+      if (!client.finished && backlog(client) <= max_backlog && client.In.size() <= max_backlog) {
+        interest |= EPOLLIN | EPOLLRDHUP;
+      }
+      if (backlog(client) > 0 || (!client.In.empty() && client.finished)) {
+        interest |= EPOLLOUT;
+      }
+      if (interest != client.interest) {
+        client.interest = interest;
+        watch(client.fd, interest, EPOLL_CTL_MOD);
+      }
+    }
+};
+
+// Times the phases of a run and reports each one on standard error, so that normal output is unaffected.
+class PhaseTimer
+{
+  public:
+    explicit PhaseTimer(bool enabled)
+    :enabled(enabled), start(chrono::steady_clock::now()) {}
+    // Reports the phase that just ended, which handled items things, and starts timing the next one.
+    void lap(const char* phase, size_t items){
+      chrono::steady_clock::time_point now = chrono::steady_clock::now();
+      if (enabled) {
+        double ms = chrono::duration<double, milli>(now - start).count();
+        cerr << "timing " << phase << ": " << items << " in " << ms << " ms";
+        if (ms > 0) {
+          cerr << " (" << static_cast<uint64_t>(static_cast<double>(items) * 1000 / ms) << " per second)";
+        }
+        cerr << '\n';
+      }
+      start = now;
+    }
+  private:
+    bool enabled;
+    chrono::steady_clock::time_point start;
+};
+
+/*
+ Parses the registration lines in text, which is REG_TIMESTAMP|USER_ID|PIN|STARTING_BALANCE per line, into users.
+ Parsing stops at a line whose timestamp field is empty, and stopped is set so that later chunks are ignored too.
+*/
+void parse_registrations(string_view text, vector<User> &users, bool &stopped, pmr::memory_resource* history){
+  while (!text.empty()) {
+    size_t eol = text.find('\n');
+    string_view line = text.substr(0, eol);
+    text = (eol == string_view::npos) ? string_view() : text.substr(eol + 1);
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    if (line.empty()) {
+        continue;
+    }
+    string_view fields[4];
+    for (size_t i = 0; i < 3; ++i) {
+        size_t bar = line.find('|');
+        fields[i] = line.substr(0, bar);
+        line = (bar == string_view::npos) ? string_view() : line.substr(bar + 1);
+    }
+    fields[3] = line;
+    if (fields[0].empty()) {
+        stopped = true;
+        return;
+    }
+    // The ID and PIN stay views of text until the bank copies them into its name arena.
+    users.emplace_back(parse_timestamp(fields[0]), fields[1], fields[2], parse_number(fields[3]), history);
+  }
+}
+
+/*
+ Loads the registration file into the bank. The file is memory mapped and split into line-aligned chunks that are parsed on the threads of pool;
+ the parsed users are then added to the bank in file order, so the result is the same as reading the file one line at a time.
+ Returns false if the file cannot be opened.
+*/
+bool load_registrations(const string &fileName, Bank &myBank, ThreadPool &pool){
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  MappedFile file(fd);
+  close(fd);
+  string_view text = file.contents();
+  // Small files are not worth starting threads for, so each thread gets at least this many bytes.
+  const size_t min_chunk = 1 << 20;
+  size_t num_chunks = max<size_t>(1, min<size_t>(pool.size(), text.size() / min_chunk));
+  vector<string_view> chunks;
+  size_t begin = 0;
+  for (size_t i = 1; i <= num_chunks && begin < text.size(); ++i) {
+    size_t end = (i == num_chunks) ? text.size() : text.find('\n', max(begin, text.size() * i / num_chunks));
+    end = (end == string_view::npos) ? text.size() : end + 1;
+    chunks.push_back(text.substr(begin, end - begin));
+    begin = end;
+  }
+  vector<vector<User>> parsed(chunks.size());
+  // Constructing a user does not allocate from the pool, so the workers can all hand it out; only the main thread uses it afterwards.
+  pmr::memory_resource* history = myBank.history_resource();
+  // vector<bool> packs its elements into shared words, so the per-chunk flags are kept as chars.
+  vector<char> stopped(chunks.size(), 0);
+  pool.run(chunks.size(), [&](size_t i) {
+    bool chunk_stopped = false;
+    parse_registrations(chunks[i], parsed[i], chunk_stopped, history);
+    stopped[i] = chunk_stopped;
+  });
+  for (size_t i = 0; i < parsed.size(); ++i) {
+    myBank.add_users(move(parsed[i]));
+    if (stopped[i]) {
+      break;
+    }
+  }
+  return true;
+}
+
+/*
+ Saves the bank to path so that a crash at any moment leaves either the old file or the whole new snapshot there.
+ The snapshot is written to a temporary file next to path, synced and renamed over path, and then the directory is synced so the
+ rename itself is on disk. Returns false if any step fails; path is then left as it was.
+*/
+bool save_snapshot_file(const Bank &myBank, const string &path){
+  // Renaming over a device or a directory would replace it rather than write to it, so only regular files are replaced.
+  struct stat existing;
+  if (stat(path.c_str(), &existing) == 0 && !S_ISREG(existing.st_mode)) {
+    return false;
+  }
+  string temp = path + ".tmp";
+  int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool written;
+  {
+    OutputBuffer file(fd);
+    myBank.save_snapshot(file);
+    written = file.flush();
+  }
+  written = (fsync(fd) == 0) && written;
+  written = (close(fd) == 0) && written;
+  if (!written || rename(temp.c_str(), path.c_str()) != 0) {
+    unlink(temp.c_str());
+    return false;
+  }
+  size_t slash = path.rfind('/');
+  string directory = (slash == string::npos) ? "." : path.substr(0, max<size_t>(slash, 1));
+  int dir_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir_fd < 0) {
+    return false;
+  }
+  bool synced = (fsync(dir_fd) == 0);
+  close(dir_fd);
+  return synced;
+}
+
+// This struct holds the settings chosen on the command line.
+struct Options
+{
+    bool verbose = false;
+    string filename;
+    // The number of threads used for parallel work such as settling large batches; 1 keeps everything on the main thread.
+    size_t threads = 1;
+    // The number of account shards the operations are split over; 0 runs them all on the main thread.
+    size_t shards = 0;
+    // A snapshot to start from instead of a registration file, and one to write at the end of the operations section.
+    string restore_file;
+    string dump_file;
+    // The write-ahead log to recover from and append to.
+    string log_file;
+    // Answer the queries on the thread pool instead of one at a time.
+    bool parallel_queries = false;
+    // Remember the answer to every distinct query and reuse it for repeats.
+    bool cache_queries = false;
+    // Report how long loading, the operations, the final drain and the queries take.
+    bool timings = false;
+    // Where to write the --stats report, if anywhere.
+    string stats_file;
+    // Answer queries that come among the operations straight away, against the ledger as it is at that point.
+    bool online = false;
+    // Serve clients on this Unix domain socket instead of reading commands from standard input.
+    string socket_path;
+    // Read standard input as a binary command stream, or convert the text stream on standard input into one written to convert_file.
+    bool binary = false;
+    string convert_file;
 };
 
-void get_mode(int argc, char * argv[], bool &isVerbose, string &filename) {
+void get_mode(int argc, char * argv[], Options &options) {
   //  This line tells getopt_long not to automatically print error messages for unrecognized options, allowing the program to handle error messages manually.
   opterr = false;
   // The variable choice is used to store the result of each parsed option from getopt_long.
@@ -681,11 +3595,24 @@ void get_mode(int argc, char * argv[], bool &isVerbose, string &filename) {
     { "help",    no_argument,       nullptr, 'h'  },
     { "file",    required_argument, nullptr, 'f'  },
     { "verbose", no_argument,       nullptr, 'v'  },
+    { "threads", required_argument, nullptr, 't'  },
+    { "shards",  required_argument, nullptr, 'S'  },
+    { "restore", required_argument, nullptr, 'r'  },
+    { "dump",    required_argument, nullptr, 'd'  },
+    { "wal",     required_argument, nullptr, 'w'  },
+    { "parallel-queries", no_argument,  nullptr, 'q'  },
+    { "cache-queries", no_argument,     nullptr, 'c'  },
+    { "timings", no_argument,           nullptr, 'T'  },
+    { "stats",   required_argument, nullptr, 's'  },
+    { "online",  no_argument,       nullptr, 'o'  },
+    { "socket",  required_argument, nullptr, 'u'  },
+    { "binary",  no_argument,       nullptr, 'b'  },
+    { "convert", required_argument, nullptr, 'C'  },
     // This is terminator for long_options.
     { nullptr,   0,                 nullptr, '\0' }
   };
   /*
-   If getopt_long successfully identifies an option, it returns the option’s corresponding character h, f, or v.
+   If getopt_long successfully identifies an option, it returns the option’s corresponding character h, f, v, t, S, r, d, w, q, c, T, s, o, u, b or C.
    The character is implicitly converted to its integer representation when initializing choice.
    If there are no more options to process, getopt_long returns -1.
    Each time the loop iterates, getopt_long processes the next option.
@@ -693,12 +3620,25 @@ void get_mode(int argc, char * argv[], bool &isVerbose, string &filename) {
    Optind is a global variable declared in the getopt.h file.
    The function getopt_long checks argv[optind] when called.
   */
-  while ((choice = getopt_long(argc, argv, "hf:v", long_options, &dummy)) != -1) {
+  while ((choice = getopt_long(argc, argv, "hf:vt:S:r:d:w:qcTs:ou:bC:", long_options, &dummy)) != -1) {
       // Based on the value of choice, the function handles each option with the use of the switch statement.
     switch (choice) {
       case 'h':
         cout << "This program simulates EECS281 bank.\n";
         cout << "It takes in a registration file, follows commands, then outputs.\n";
+        cout << "Use --threads N (or -t N) to load the registration file and settle large batches of transactions on N threads; 0 means one per core.\n";
+        cout << "Use --shards N (or -S N) to split the accounts over N shards that handle logins, logouts and checks in parallel.\n";
+        cout << "Use --dump FILE (or -d FILE) to save the bank as it is at the end of the operations, before pending transactions run.\n";
+        cout << "Use --restore FILE (or -r FILE) to start from a saved bank instead of a registration file; the commands carry on from there.\n";
+        cout << "Use --wal FILE (or -w FILE) to log operations to FILE; operations already in it are replayed first, after any snapshot.\n";
+        cout << "Use --parallel-queries (or -q) to answer the queries on the --threads pool; the output stays in input order.\n";
+        cout << "Use --cache-queries (or -c) to answer repeated queries from a cache; hit and miss counts go to standard error.\n";
+        cout << "Use --timings (or -T) to report the time and throughput of each phase on standard error.\n";
+        cout << "Use --stats FILE (or -s FILE) to write counters, rejection reasons and latency histograms to FILE as JSON at exit.\n";
+        cout << "Use --online (or -o) to accept l, r, h and s queries among the operations and answer each one as soon as it is read.\n";
+        cout << "Use --socket PATH (or -u PATH) to serve clients on a Unix domain socket until SIGINT or SIGTERM; each command line is answered with its output and an empty line.\n";
+        cout << "Use --convert FILE (or -C FILE) to convert the commands on standard input to the binary format in FILE and exit; add --online to keep queries among the operations.\n";
+        cout << "Use --binary (or -b) to read standard input as a binary command stream made by --convert.\n";
         exit(0);
       case 'f':{
         /*
@@ -711,12 +3651,61 @@ void get_mode(int argc, char * argv[], bool &isVerbose, string &filename) {
         string arg{optarg};
         // Making sure that only txt files can be accepted.
         if (arg[arg.length() - 1] == 't') {
-            filename = arg;
+            options.filename = arg;
         }
         break;
       }
       case 'v':
-        isVerbose = true;
+        options.verbose = true;
+        break;
+      case 't':{
+        // A thread count of 0 means one thread per available core.
+        options.threads = strtoull(optarg, NULL, 10);
+        if (options.threads == 0) {
+            options.threads = max(1u, thread::hardware_concurrency());
+        }
+        break;
+      }
+      case 'S':{
+        // Like the thread count, 0 shards means one per available core.
+        options.shards = strtoull(optarg, NULL, 10);
+        if (options.shards == 0) {
+            options.shards = max(1u, thread::hardware_concurrency());
+        }
+        break;
+      }
+      case 'r':
+        options.restore_file = optarg;
+        break;
+      case 'd':
+        options.dump_file = optarg;
+        break;
+      case 'w':
+        options.log_file = optarg;
+        break;
+      case 'q':
+        options.parallel_queries = true;
+        break;
+      case 'c':
+        options.cache_queries = true;
+        break;
+      case 'T':
+        options.timings = true;
+        break;
+      case 's':
+        options.stats_file = optarg;
+        break;
+      case 'o':
+        options.online = true;
+        break;
+      case 'u':
+        options.socket_path = optarg;
+        break;
+      case 'b':
+        options.binary = true;
+        break;
+      case 'C':
+        options.convert_file = optarg;
         break;
       default:
         cerr << "Error: invalid option" << endl;
@@ -728,196 +3717,242 @@ void get_mode(int argc, char * argv[], bool &isVerbose, string &filename) {
 int main(int argc, char* argv[]) {
     // IO optimization being utilized here.
     ios_base::sync_with_stdio(false);
-    bool verbose = false;
-    string fileName;
-    get_mode(argc, argv, verbose, fileName);
+    Options options;
+    get_mode(argc, argv, options);
+    // Converting a command stream needs no bank at all.
+    if (!options.convert_file.empty()) {
+        int fd = open(options.convert_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            cerr << "Binary command file failed to open." << endl;
+            exit(1);
+        }
+        CommandReader commands(STDIN_FILENO);
+        {
+            OutputBuffer file(fd);
+            convert_commands(commands, file, options.online);
+        }
+        close(fd);
+        if (commands.failed()) {
+            cerr << "Error: Reading from cin has failed" << endl;
+            exit(1);
+        }
+        return 0;
+    }
+    bool verbose = options.verbose;
+    const string &fileName = options.filename;
     // the filename was passed by reference
-    if (fileName.empty()) {
+    if (fileName.empty() && options.restore_file.empty()) {
         cerr << "filename has not been specified" << endl;
         exit(1);
     }
-    Bank myBank = Bank(verbose);
-    // Here we are using the ifstream constructor and specifying the file we are using and the fact we are reading
-    ifstream regfile(fileName, ifstream::in);
-    if(regfile.good()){
-        while(regfile){
-            string temp_time;
-            uint64_t time;
-            string name;
-            string pin;
-            string temp_num;
-            uint64_t balance;
-            // getline(regfile, temptime, '|'); reads a portion of the line up to the first | character and stores it in temptime.
-            getline(regfile, temp_time, '|');//time
-            if (temp_time.empty()) {
-                break;
-            }
-            temp_time = temp_time.substr(0,2) + temp_time.substr(3,2) + temp_time.substr(6,2) + temp_time.substr(9,2) + temp_time.substr(12,2) + temp_time.substr(15,2);
-            const char* ctime = temp_time.c_str();
-            time = strtoull(ctime, NULL, 10);
-            getline(regfile, name, '|');
-            getline(regfile, pin, '|');
-            getline(regfile, temp_num);
-            const char* tempstring = temp_num.c_str();
-            balance = strtoull(tempstring, NULL, 10);
-            User tempUser = User(time, name, pin, balance);
-            myBank.add_user(tempUser);
+    // All normal output goes through one buffer; it is static so that it is still flushed when the program calls exit.
+    static OutputBuffer out(STDOUT_FILENO);
+    // Each shard needs a thread of its own, so the pool is at least as big as the number of shards.
+    ThreadPool pool(max(options.threads, options.shards));
+    // A server's bank writes into responses, which are handed out to the clients one command at a time.
+    static OutputBuffer responses;
+    bool serving = !options.socket_path.empty();
+    Bank myBank = Bank(verbose, serving ? responses : out, &pool);
+    PlaceOrder order;
+    PhaseTimer timer(options.timings);
+    unique_ptr<Stats> stats;
+    if (!options.stats_file.empty()) {
+        stats = make_unique<Stats>();
+        myBank.set_stats(stats.get());
+    }
+    if (!options.restore_file.empty()) {
+        // The snapshot is memory mapped, so its tables are copied straight out of the page cache.
+        int fd = open(options.restore_file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            cerr << "Snapshot file failed to open." << endl;
+            exit(1);
         }
+        MappedFile snapshot(fd);
+        close(fd);
+        if (!myBank.load_snapshot(snapshot.contents())) {
+            cerr << "Snapshot file is not a valid bank snapshot." << endl;
+            exit(1);
+        }
+        order.resume(myBank);
     }
-    else {
+    // The registration file is memory mapped and parsed on the pool's threads; see load_registrations.
+    else if (!load_registrations(fileName, myBank, pool)) {
         cerr << "Registration file failed to open." << endl;
         exit(1);
     }
-    regfile.close();
-    if (cin.fail()) {
-        cerr << "Error: Reading from cin has failed" << endl;
-    exit(1);
-    }
-    uint64_t prev_place_time = 0;
-    int placed = 0;
-    string curr_time;
     /*
      We are using two different files. One is registration file and the other is a command file.
      When running the program from the command line, you can redirect cin to read from a file by using < operator.
+     The command file is read through CommandReader, which hands out each field as a view without copying it, or with --binary through BinaryCommandReader.
      */
-    if(!cin.fail()){
-        string junk;
-        string temp;
-        cin >> temp;
-        // In every given file the operations section ends with $$$, and is followed by queries.
-        while(temp != "$$$"){
-            switch(temp[0]){
-                case '#':{
-                    getline(cin, junk);
-                    break;
-                }
-                case 'l':{
-                    string uID;
-                    string pin;
-                    string IP;
-                    cin >> uID;
-                    cin >> pin;
-                    cin >> IP;
-                    bool success = myBank.login(uID, pin, IP);
-                    if (success) {
-                        if (verbose) {
-                            cout << "User " << uID << " logged in." << "\n";
-                        }
-                    }
-                    else {
-                        if (verbose) {
-                            cout << "Login failed for " << uID << "." << "\n";
-                        }
-                    }
-                    break;
+    CommandReader commands = options.binary ? CommandReader(string_view()) : CommandReader(STDIN_FILENO);
+    // A binary stream is opened once the accounts are loaded, since its names are looked up in them as it is opened.
+    unique_ptr<BinaryCommandReader> binary;
+    if (options.binary) {
+        binary = make_unique<BinaryCommandReader>(STDIN_FILENO, myBank);
+        if (!binary->is_open()) {
+            cerr << "Standard input is not a binary command stream." << endl;
+            exit(1);
+        }
+    }
+    // Operations logged by an earlier run are replayed on top of the registrations or snapshot before any new ones are read.
+    unique_ptr<WriteAheadLog> log;
+    if (!options.log_file.empty()) {
+        log = make_unique<WriteAheadLog>(options.log_file);
+        if (!log->is_open()) {
+            cerr << "Write-ahead log failed to open." << endl;
+            exit(1);
+        }
+        log->recover(myBank, order);
+    }
+    timer.lap("load", myBank.get_num_users());
+    Operation op;
+    Query query;
+    size_t operations = 0;
+    size_t queries = 0;
+    unique_ptr<QueryCache> cache;
+    if (options.cache_queries) {
+        cache = make_unique<QueryCache>();
+    }
+    // Cached answers are only good for the ledger they came from, and the ledger only changes when transactions execute.
+    size_t cached_ledger = myBank.get_num_executed();
+    auto refresh_cache = [&]() {
+        if (cache && myBank.get_num_executed() != cached_ledger) {
+            cache->clear();
+            cached_ledger = myBank.get_num_executed();
+        }
+    };
+    // A query from among the operations is written out straight away, so whoever sent it does not wait for the buffer to fill.
+    auto answer_online = [&]() {
+        refresh_cache();
+        answer_query(myBank, out, query, cache.get(), stats.get());
+        out.flush();
+        queries++;
+    };
+    // A binary stream marks its queries as queries, so they are answered as they come whether or not the run is online.
+    auto next_command = [&]() {
+        return binary ? binary->next(op, query) : read_command(commands, op, query, options.online);
+    };
+    function<bool(Query&)> next_query = [&](Query &next) {
+        return binary ? binary->next_query(next) : read_query(commands, next);
+    };
+    // In every given file the operations section ends with $$$, and is followed by queries. An online run may have queries before it too.
+    CommandKind kind;
+    if (serving) {
+        BankServer server(options.socket_path);
+        if (!server.is_open()) {
+            cerr << "Socket " << options.socket_path << " failed to open." << endl;
+            exit(1);
+        }
+        // Commands are handled as in an online run, except that a place that fails the order checks is answered with the reason.
+        auto handle = [&](string_view text, string &reply) {
+            CommandReader lines(text);
+            while (!lines.at_end()) {
+                kind = read_command(lines, op, query, true);
+                if (kind == CommandKind::End) {
+                    continue;
                 }
-                case 'o':{
-                    string uID;
-                    string IP;
-                    cin >> uID;
-                    cin >> IP;
-                    bool success = myBank.logout(uID, IP);
-                    if (success) {
-                        if (verbose) {
-                            cout << "User " << uID << " logged out." << "\n";
-                        }
-                    }
-                    else {
-                        if (verbose) {
-                            cout << "Logout failed for " << uID << "." << "\n";
-                        }
-                    }
-                    break;
+                if (kind == CommandKind::Query) {
+                    refresh_cache();
+                    answer_query(myBank, responses, query, cache.get(), stats.get());
+                    queries++;
                 }
-                // This is the case for the balance command.
-                case 'b': {
-                    string userID, IP;
-                    cin >> userID >> IP;
-                    myBank.check_balance(userID, IP);
-                    break;
+                else if (const char* reason = (op.type == 'p') ? order.problem(op) : nullptr) {
+                    responses << "Error: " << reason << '\n';
                 }
-                // This is the case for the place command.
-                case 'p':{
-                    string timestamp;
-                    string IP;
-                    string sender;
-                    string recepient;
-                    string amount;
-                    string exec_date;
-                    string fee_payer;
-                    cin >> timestamp;
-                    cin >> IP;
-                    cin >> sender;
-                    cin >> recepient;
-                    cin >> amount;
-                    cin >> exec_date;
-                    cin >> fee_payer;
-                    timestamp = timestamp.substr(0,2) + timestamp.substr(3,2) + timestamp.substr(6,2) + timestamp.substr(9,2) + timestamp.substr(12,2) + timestamp.substr(15,2);
-                    exec_date = exec_date.substr(0,2) + exec_date.substr(3,2) + exec_date.substr(6,2) + exec_date.substr(9,2) + exec_date.substr(12,2) + exec_date.substr(15,2);
-                    const char* exec = exec_date.c_str();
-                    const char* time = timestamp.c_str();
-                    uint64_t execnum = strtoull(exec, NULL, 10);
-                    uint64_t timenum = strtoull(time, NULL, 10);
-                    if (prev_place_time > timenum && placed != 0) {
-                        cerr << "Invalid decreasing timestamp in 'place' command." << endl;
-                        exit(1);
-                    }
-                    if (execnum < timenum) {
-                        cerr << "You cannot have an execution date before the current timestamp." << endl;
-                        exit(1);
-                    }
-                    bool valid_T = myBank.place_transaction(timestamp, IP, amount, exec_date, fee_payer, sender, recepient);
-                    if (valid_T) {
-                        curr_time = timestamp;
-                        prev_place_time = timenum;
-                        placed++;
-                    }
-                    break;
+                else {
+                    run_operation(myBank, order, op, log.get(), stats.get());
+                    operations++;
                 }
+                responses << '\n';
+                reply.append(responses.text());
+                responses.clear();
+            }
+        };
+        // Every answer in a pass is sent only after the operations behind it are in the log.
+        server.run(handle, [&]() {
+            if (log) {
+                log->commit();
             }
-            cin >> temp;
+        });
+    }
+    else if (options.shards == 0) {
+        while ((kind = next_command()) != CommandKind::End) {
+            if (kind == CommandKind::Query) {
+                answer_online();
+                continue;
+            }
+            run_operation(myBank, order, op, log.get(), stats.get());
+            operations++;
+        }
+    }
+    else {
+        ShardedEngine engine(myBank, pool, order, log.get(), stats.get(), options.shards);
+        while ((kind = next_command()) != CommandKind::End) {
+            if (kind == CommandKind::Query) {
+                // The query has to see every operation before it, so whatever is queued runs first.
+                engine.finish();
+                answer_online();
+                continue;
+            }
+            engine.add(op);
+            operations++;
+        }
+        engine.finish();
+    }
+    if (commands.failed()) {
+        cerr << "Error: Reading from cin has failed" << endl;
+        exit(1);
+    }
+    if (log) {
+        log->commit();
+    }
+    timer.lap("operations", operations);
+    if (!options.dump_file.empty()) {
+        if (!save_snapshot_file(myBank, options.dump_file)) {
+            cerr << "Snapshot file could not be written." << endl;
+            exit(1);
         }
-        // Setting a high time lets the function executeTransaction to process all remaining pending transactions.
-        while (myBank.has_transactions()) {
-            string max_time = "999999999999";
-            myBank.execute_transaction(max_time);
+        // The snapshot is on disk and holds everything the log did, so the log starts again from empty.
+        if (log) {
+            log->clear();
         }
-        // Extracting $$$ from the command file.
-        cin >> temp;
+        timer.lap("snapshot", myBank.get_num_users());
+    }
+    // The end of the operations section executes all remaining pending transactions, and the queries follow. A server has neither.
+    if (!serving) {
+        size_t due = myBank.pending_count();
+        myBank.flush_pending();
+        timer.lap("drain", due);
         // Now we are handling the queries.
-        while(!cin.fail()){
-            switch(temp[0]){
-                case 'l':{
-                    string start_time;
-                    string end_time;
-                    cin >> start_time;
-                    cin >> end_time;
-                    myBank.list_transactions(start_time, end_time);
-                    break;
-                }
-                case 'r':{
-                    string start_time;
-                    string end_time;
-                    cin >> start_time;
-                    cin >> end_time;
-                    myBank.bank_revenue(start_time, end_time);
-                    break;
-                }
-                case 'h':{
-                    string user;
-                    cin >> user;
-                    myBank.customer_history(user);
-                    break;
-                }
-                case 's':{
-                    string day;
-                    cin >> day;
-                    myBank.summarize_day(day);
-                    break;
-                }
+        refresh_cache();
+        if (options.parallel_queries) {
+            queries = run_queries_parallel(myBank, pool, next_query, out, cache.get(), stats.get());
+        }
+        else {
+            while (next_query(query)) {
+                answer_query(myBank, out, query, cache.get(), stats.get());
+                queries++;
             }
-            cin >> temp;
         }
+    }
+    // The queries are only finished once their output has been written.
+    if (!out.flush()) {
+        cerr << "Output could not be written." << endl;
+        exit(1);
+    }
+    timer.lap("queries", queries);
+    if (stats) {
+        myBank.report_allocators(*stats);
+        ofstream report(options.stats_file);
+        stats->write_report(report, [&myBank](uint32_t index) { return myBank.get_name(index); });
+        if (!report) {
+            cerr << "Stats report could not be written." << endl;
+            exit(1);
+        }
+    }
+    if (cache) {
+        cerr << "Query cache: " << cache->get_hits() << " hits, " << cache->get_misses() << " misses." << endl;
     }
         return 0;
 }
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Checks the bank against the online test, whose queries come among the operations.
+# Usage: tests/run-online.sh BANK [extra bank options]
+# BANK is the bank binary. It is run with --online, plainly and with --verbose, and each output is compared with the expected one.
+
+BANK=$1
+shift
+DIR=$(dirname "$0")
+status=0
+
+for mode in output output-verbose; do
+    verbose=
+    if [ "$mode" = output-verbose ]; then
+        verbose=--verbose
+    fi
+    if "$BANK" --online $verbose "$@" -f "$DIR/online-reg.txt" < "$DIR/online-commands.txt" | cmp -s - "$DIR/online-$mode.txt"; then
+        echo "online $mode: ok"
+    else
+        echo "online $mode: differs from $DIR/online-$mode.txt"
+        status=1
+    fi
+done
+exit $status